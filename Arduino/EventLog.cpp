@@ -0,0 +1,73 @@
+/*
+  EventLog.cpp - Binary log ring with deferred formatting.
+  Copyright 2016 Greg Cunningham, CuriousTech.net
+*/
+
+#include "EventLog.h"
+
+static const char fmtList[LOG_Count][40] PROGMEM = {
+  "Boot, reset reason %d",
+  "No SSID. Waiting for EspTouch",
+  "SmartConfig set",
+  "WiFi connected ch %d stage %d",
+  "Fast connect failed. Scanning",
+  "Connect failed. Retry %d, %ds",
+  "Connect failed. Starting SmartConfig",
+  "Link lost. Reconnecting",
+  "Error %d",
+  "Host call failed (%d) count %d",
+  "Bad password, locked %ds",
+  "Rule error at %d",
+  "Rule action %d, %dms after input",
+  "Door %d (%dcm)",
+  "Car %d (%dcm)",
+  "OTA start %d bytes",
+  "OTA done %d bytes",
+  "OTA error %d at %d",
+  "Motion %d, read %dms after edge",
+};
+
+static const char modNames[LM_Count][5] = { "main", "wifi", "host", "pb", "rule" };
+static const char levelNames[] = "EWID";
+
+EventLog::EventLog()
+{
+  m_seq = 0;
+  for(uint8_t i = 0; i < LM_Count; i++)
+    m_level[i] = LL_Info;
+}
+
+void EventLog::setLevel(uint8_t module, uint8_t level)
+{
+  if(module < LM_Count)
+    m_level[module] = level;
+}
+
+uint32_t EventLog::head()
+{
+  return m_seq;
+}
+
+uint32_t EventLog::oldest()
+{
+  return (m_seq > LOG_SIZE) ? m_seq - LOG_SIZE : 0;
+}
+
+// Format the entry at pos and advance it.  Returns the length, 0 if there is nothing new
+int EventLog::format(uint32_t &pos, char *pBuf, int size)
+{
+  if(pos < oldest()) // reader fell behind, skip what was overwritten
+    pos = oldest();
+  if(pos >= m_seq)
+    return 0;
+
+  const logEntry &e = m_ring[pos & (LOG_SIZE - 1)];
+  pos++;
+
+  int n = snprintf(pBuf, size, "%lu.%03lu %s %c ", (unsigned long)(e.ms / 1000), (unsigned long)(e.ms % 1000), modNames[e.module], levelNames[e.level]);
+  if(n < size)
+    n += snprintf_P(pBuf + n, size - n, fmtList[e.id], (int)e.arg[0], (int)e.arg[1]);
+  return (n < size) ? n : size - 1;
+}
+
+EventLog eventLog;
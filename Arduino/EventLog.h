@@ -0,0 +1,96 @@
+/*
+  EventLog.h - Binary log ring with deferred formatting.
+  Copyright 2016 Greg Cunningham, CuriousTech.net
+
+  add() stores a message ID and 2 raw arguments (a level check and a 16 byte copy).
+  Text is only built by format() when a reader (/log WebSocket or /log.txt) asks for it.
+*/
+#ifndef EVENTLOG_H
+#define EVENTLOG_H
+
+#include <Arduino.h>
+
+#define LOG_SIZE 64 // entries, power of 2
+
+enum logModule
+{
+  LM_Main,
+  LM_WiFi,
+  LM_Host,
+  LM_PB,
+  LM_Rule,
+  LM_Count
+};
+
+enum logLevel
+{
+  LL_Error,
+  LL_Warn,
+  LL_Info,
+  LL_Debug,
+};
+
+enum logMsg // keep in sync with fmtList in EventLog.cpp
+{
+  LOG_Boot,
+  LOG_NoSSID,
+  LOG_SmartConfigSet,
+  LOG_Connected,
+  LOG_FastFailed,
+  LOG_Retry,
+  LOG_SmartConfig,
+  LOG_LinkLost,
+  LOG_PBError,
+  LOG_HostFail,
+  LOG_BadPass,
+  LOG_RuleError,
+  LOG_RuleFired,
+  LOG_Door,
+  LOG_Car,
+  LOG_OtaStart,
+  LOG_OtaDone,
+  LOG_OtaError,
+  LOG_Motion,
+  LOG_Count
+};
+
+struct logEntry
+{
+  uint32_t ms;
+  uint8_t  id;
+  uint8_t  module;
+  uint8_t  level;
+  int32_t  arg[2];
+};
+
+class EventLog
+{
+public:
+  EventLog();
+  void add(uint8_t module, uint8_t level, uint8_t id, int32_t a0 = 0, int32_t a1 = 0)
+  {
+    if(level > m_level[module])
+      return;
+    logEntry &e = m_ring[m_seq & (LOG_SIZE - 1)];
+    e.ms = millis();
+    e.id = id;
+    e.module = module;
+    e.level = level;
+    e.arg[0] = a0;
+    e.arg[1] = a1;
+    m_seq++;
+  }
+  void     setLevel(uint8_t module, uint8_t level);
+  uint32_t head(void);
+  uint32_t oldest(void);
+  int      format(uint32_t &pos, char *pBuf, int size);
+
+private:
+  logEntry m_ring[LOG_SIZE];
+  uint32_t m_seq;   // total entries added
+  uint8_t  m_level[LM_Count];
+};
+
+extern EventLog eventLog;
+
+#endif // EVENTLOG_H
@@ -21,12 +21,13 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
-// Build with Arduino IDE 1.8.9, esp8266 SDK 2.5.0
+// Build with Arduino IDE 1.8.9, esp8266 SDK 2.5.0 (2.7.0+ to accept gzipped images at /update)
 
 //uncomment to enable Arduino IDE Over The Air update code
 #define OTA_ENABLE
 #define USE_OLED
 #define DEBUG
+//#define USE_TRACE // record raw sensor samples for /trace.bin (8K RAM)
 
 //#define USE_SPIFFS // Uses 7K more program space
 
@@ -49,6 +50,8 @@ SOFTWARE.
 #include <FS.h>
 #include <ArduinoOTA.h>
 #endif
+#include <Updater.h>
+#include <core_version.h> // ARDUINO_ESP8266_RELEASE_x_y_z
 #ifdef USE_SPIFFS
 #include <FS.h>
 #include <SPIFFSEditor.h>
@@ -56,8 +59,16 @@ SOFTWARE.
 #include "pages.h"
 #endif
 #include "jsonstring.h"
+#include "Rules.h"
+#include "InputCapture.h"
+#include "EventLog.h"
+#include "HeapStat.h"
+#include "strfmt.h"
 #include <AM2320.h>
 #include <NewPingESP8266.h>
+#ifdef USE_TRACE
+#include "SensorTrace.h"
+#endif
 
 int serverPort = 80;                    // port fwd for fwdip.php
 
@@ -90,6 +101,8 @@ AM2320 am;
 
 AsyncWebServer server( serverPort );
 AsyncWebSocket ws("/ws"); // access at ws://[esp ip]/ws
+AsyncWebSocket logWs("/log"); // log stream
+uint32_t logPos; // next log entry to stream
 
 PushBullet pb;
 
@@ -100,11 +113,23 @@ JsonClient jsonPush(jsonPushCallback);
 
 UdpTime utime;
 
+void ruleCallback(uint8_t action, const char *pText);
+Rules rules(ruleCallback);
+uint32_t ruleInputMs; // when the input behind this rules.evaluate() changed
+
+#ifdef USE_TRACE
+SensorTrace trace;
+#endif
+
 float temp;
 float rh;
+bool bTempValid; // first AM2320 reading done
 
 eeMem ee;
 
+InputCapture inputs;
+int8_t inMotion;
+
 bool bDoorOpen;
 bool bCarIn;
 bool bPulseRemote;
@@ -117,7 +142,41 @@ uint16_t displayTimer;
 
 bool bConfigDone = false;
 bool bStarted = false;
-uint32_t connectTimer;
+uint32_t bootTime;   // ms from boot to first sendState() after connecting
+
+enum connStage
+{
+  CS_Fast,   // cached BSSID/channel/IP, no scan or DHCP
+  CS_Scan,   // full scan and DHCP
+  CS_Retry,  // rescan with backoff, then SmartConfig
+  CS_Smart,  // SmartConfig listening, then back to CS_Retry
+};
+
+uint8_t connStage;
+uint8_t connRetries;
+uint16_t connWait;   // seconds left for this stage
+#define CONN_RETRIES 4
+#define SMART_WAIT  120  // seconds of SmartConfig between retries of the stored AP
+WiFiEventHandler gotIPHandler;
+volatile bool bGotIP;  // an address was assigned since last checked
+bool bWasConnected;    // WL_CONNECTED on the last check
+
+uint16_t stateVer;    // bumped when the state in dataJson() changes (ETag for /state)
+uint16_t settingsVer; // bumped when a setting changes (ETag for /json)
+uint16_t bootNonce;   // random per boot, so versions from before a reboot never match
+
+#define WAIT_SLOTS 4
+#define WAIT_MAX   60 // max long-poll seconds
+
+struct waitReq // held ?wait= requests
+{
+  AsyncWebServerRequest *req;
+  uint16_t ver;      // version the client already has
+  bool     bSettings;
+  uint32_t start;    // millis
+  uint32_t timeout;  // ms
+};
+waitReq waitList[WAIT_SLOTS];
 
 #define SONAR_NUM    2   // Number of sensors.
 #define MAX_DISTANCE 400 // Maximum distance (in cm) to ping.
@@ -127,13 +186,6 @@ NewPingESP8266 sonar[SONAR_NUM] = {   // Sensor object array.
   NewPingESP8266(SR2, SR2, MAX_DISTANCE)  // Car
 };
 
-String sDec(int t) // just 123 to 12.3 string
-{
-  String s = String( t / 10 ) + ".";
-  s += t % 10;
-  return s;
-}
-
 String dataJson()
 {
   jsonString js("state");
@@ -147,7 +199,9 @@ String dataJson()
   js.Var("carVal", carVal);         // use value to check for what your threshold should be
   js.Var("doorVal", doorVal);
   js.Var("motion", bMotion);
-  return js.Close();
+  String s = js.Close();
+  heapStat.tag(HT_DataJson, s.length());
+  return s;
 }
 
 String settingsJson()
@@ -170,7 +224,468 @@ String settingsJson()
   s += String(ee.hostIP[3]);
   js.Var("host", s);
   js.Var("rt", ee.rate);
-  return js.Close();
+  js.Var("rules", rules.source(ee.rules) );
+  js.Var("ver", (int)settingsId());
+  String sJs = js.Close();
+  heapStat.tag(HT_SettingsJson, sJs.length());
+  return sJs;
+}
+
+// Settings version given to clients for optimistic concurrency (positive, fits a JSON int)
+int32_t settingsId()
+{
+  return (int32_t)(bootNonce & 0x7FFF) << 16 | settingsVer;
+}
+
+String eTag(uint16_t ver, bool bSettings)
+{
+  String s = "\"";
+  s += bSettings ? "c" : "s";
+  s += bootNonce;
+  s += "-";
+  s += ver;
+  s += "\"";
+  return s;
+}
+
+// Send /state or /json with the current version as its ETag
+void sendVersioned(AsyncWebServerRequest *request, bool bSettings)
+{
+  AsyncWebServerResponse *response = request->beginResponse(200, "text/json", bSettings ? settingsJson() : dataJson() );
+  response->addHeader("ETag", eTag(bSettings ? settingsVer : stateVer, bSettings) );
+  request->send(response);
+}
+
+void sendNotModified(AsyncWebServerRequest *request, uint16_t ver, bool bSettings)
+{
+  AsyncWebServerResponse *response = request->beginResponse(304);
+  response->addHeader("ETag", eTag(ver, bSettings) );
+  request->send(response);
+}
+
+// If-None-Match: answer 304 if unchanged, or hold the request if ?wait=seconds is given
+void handleVersioned(AsyncWebServerRequest *request, bool bSettings)
+{
+  uint16_t ver = bSettings ? settingsVer : stateVer;
+
+  if(!request->hasHeader("If-None-Match") || request->header("If-None-Match") != eTag(ver, bSettings) )
+  {
+    sendVersioned(request, bSettings);
+    return;
+  }
+
+  int wait = request->hasParam("wait") ? request->getParam("wait")->value().toInt() : 0;
+  if(wait <= 0)
+  {
+    sendNotModified(request, ver, bSettings);
+    return;
+  }
+  if(wait > WAIT_MAX) wait = WAIT_MAX;
+
+  for(uint8_t i = 0; i < WAIT_SLOTS; i++)
+  {
+    if(waitList[i].req == NULL)
+    {
+      waitList[i].req = request;
+      waitList[i].ver = ver;
+      waitList[i].bSettings = bSettings;
+      waitList[i].start = millis();
+      waitList[i].timeout = wait * 1000;
+      request->onDisconnect([request](){ // client gave up
+        for(uint8_t j = 0; j < WAIT_SLOTS; j++)
+          if(waitList[j].req == request)
+            waitList[j].req = NULL;
+      });
+      return;
+    }
+  }
+  sendNotModified(request, ver, bSettings); // no free slot, client polls again
+}
+
+// Called from loop() to release held requests on change or timeout
+void checkWaiting()
+{
+  for(uint8_t i = 0; i < WAIT_SLOTS; i++)
+  {
+    waitReq &w = waitList[i];
+    if(w.req == NULL)
+      continue;
+    AsyncWebServerRequest *request = w.req;
+    if(w.ver != (w.bSettings ? settingsVer : stateVer) )
+    {
+      w.req = NULL;
+      sendVersioned(request, w.bSettings);
+    }
+    else if(millis() - w.start >= w.timeout)
+    {
+      w.req = NULL;
+      sendNotModified(request, w.ver, w.bSettings);
+    }
+  }
+}
+
+void wifiConnect(uint8_t stage)
+{
+  connStage = stage;
+  switch(stage)
+  {
+    case CS_Fast:
+      WiFi.config(IPAddress(ee.wifiIP), IPAddress(ee.wifiGW), IPAddress(ee.wifiMask), IPAddress(ee.wifiDNS));
+      WiFi.begin(ee.szSSID, ee.szSSIDPassword, ee.wifiChannel, ee.wifiBSSID);
+      connWait = 5;
+      break;
+    case CS_Scan:
+      WiFi.config(0U, 0U, 0U); // back to DHCP
+      WiFi.begin(ee.szSSID, ee.szSSIDPassword);
+      connWait = 10;
+      break;
+    case CS_Retry: // 10, 20, 40, 80 seconds (AP may still be booting after a power blip)
+      WiFi.disconnect();
+      WiFi.begin(ee.szSSID, ee.szSSIDPassword);
+      connWait = 10 << connRetries;
+      break;
+  }
+}
+
+void copyIP(IPAddress ip, uint8_t *p)
+{
+  for(uint8_t i = 0; i < 4; i++)
+    p[i] = ip[i];
+}
+
+void ruleCallback(uint8_t action, const char *pText)
+{
+  eventLog.add(LM_Rule, LL_Info, LOG_RuleFired, action, millis() - ruleInputMs);
+  switch(action)
+  {
+    case RA_Pulse:
+      bPulseRemote = true;
+      break;
+    case RA_Open:
+      if(!bDoorOpen) bPulseRemote = true;
+      break;
+    case RA_Close:
+      if(bDoorOpen) bPulseRemote = true;
+      break;
+    case RA_Host:
+      CallHost(Reason_Alert, pText);
+      break;
+    case RA_Push:
+      pb.send("GDO", pText, ee.pbToken);
+      break;
+    case RA_Alert:
+      {
+        jsonString js("alert");
+        js.Var("text", pText);
+        ws.textAll(js.Close());
+      }
+      break;
+  }
+}
+
+// Checks a key against the lockout.  Returns true (and extends the lockout) if wrong or locked out
+bool badPass(IPAddress ip, const char *pPass)
+{
+  if(strcmp(pPass, ee.szControlPassword) == 0 && nWrongPass == 0)
+    return false;
+
+  if(nWrongPass == 0) // it takes at least 10 seconds to recognize a wrong password
+    nWrongPass = 10;
+  else if((nWrongPass & 0xFFFFF000) == 0 ) // time doubles for every high speed wrong password attempt.  Max 1 hour
+    nWrongPass <<= 1;
+  if(ip != lastIP)  // if different IP drop it down
+     nWrongPass = 10;
+  eventLog.add(LM_Main, LL_Warn, LOG_BadPass, nWrongPass);
+
+  jsonString js("hack");
+  js.Var("ip", ip.toString() );
+  js.Var("pass", pPass);
+  ws.textAll(js.Close());
+
+  lastIP = ip;
+  return true;
+}
+
+// Resumable /update: POST ?key=&size=&md5=&offset= with the image bytes from offset as the body.
+// A dropped transfer resumes at "offset" from the reply or GET /update, within the same boot.
+// Gzip images are passed through to the Updater on core 2.7.0+, older bootloaders can't unpack them.
+#if defined(ARDUINO_ESP8266_RELEASE_2_4_0) || defined(ARDUINO_ESP8266_RELEASE_2_4_1) || defined(ARDUINO_ESP8266_RELEASE_2_4_2) \
+ || defined(ARDUINO_ESP8266_RELEASE_2_5_0) || defined(ARDUINO_ESP8266_RELEASE_2_5_1) || defined(ARDUINO_ESP8266_RELEASE_2_5_2) \
+ || defined(ARDUINO_ESP8266_RELEASE_2_6_0) || defined(ARDUINO_ESP8266_RELEASE_2_6_1) || defined(ARDUINO_ESP8266_RELEASE_2_6_2) \
+ || defined(ARDUINO_ESP8266_RELEASE_2_6_3)
+#define OTA_NO_GZIP
+#endif
+uint32_t otaSize;
+uint32_t otaWritten;   // bytes accepted so far
+uint8_t  otaRestart;   // seconds until restart after a good image
+AsyncWebServerRequest *otaOwner; // request writing to Update now
+
+struct otaReq // per request, in request->_tempObject (freed with the request)
+{
+  int      status;
+  uint32_t skip;       // resent bytes to drop
+  const char *msg;
+};
+
+void otaBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)
+{
+  otaReq *r = (otaReq *)request->_tempObject;
+
+  if(index == 0) // first piece of this request
+  {
+    r = (otaReq *)malloc(sizeof(otaReq));
+    if(r == NULL)
+      return;
+    request->_tempObject = r;
+    r->status = 200;
+    r->skip = 0;
+    r->msg = "";
+    if(!request->hasParam("key") || badPass(request->client()->remoteIP(), request->getParam("key")->value().c_str()) )
+    {
+      r->status = 401;
+      r->msg = "bad key";
+      return;
+    }
+    if(otaOwner && otaOwner != request) // one writer at a time
+    {
+      r->status = 409;
+      r->msg = "busy";
+      return;
+    }
+    otaOwner = request;
+    request->onDisconnect([request](){ if(otaOwner == request) otaOwner = NULL; });
+    uint32_t offset = request->hasParam("offset") ? request->getParam("offset")->value().toInt() : 0;
+    if(offset == 0) // new image
+    {
+      if(Update.isRunning())
+        Update.end(); // incomplete, so this discards it
+      otaSize = request->hasParam("size") ? request->getParam("size")->value().toInt() : 0;
+      otaWritten = 0;
+      if(!request->hasParam("md5") || request->getParam("md5")->value().length() != 32)
+      {
+        r->status = 410;
+        r->msg = "md5 required";
+        return;
+      }
+      Update.runAsync(true);
+      if(otaSize == 0 || !Update.begin(otaSize) )
+      {
+        r->status = 500;
+        return;
+      }
+      Update.setMD5(request->getParam("md5")->value().c_str());
+      eventLog.add(LM_Main, LL_Info, LOG_OtaStart, otaSize);
+    }
+    else if(!Update.isRunning() || offset > otaWritten) // gap, client must resume at otaWritten
+    {
+      r->status = 409;
+      return;
+    }
+    r->skip = otaWritten - offset;
+  }
+  if(r == NULL || r->status != 200)
+    return;
+
+  if(r->skip)
+  {
+    size_t n = (r->skip < len) ? r->skip : len;
+    data += n;
+    len -= n;
+    r->skip -= n;
+  }
+  if(len == 0)
+    return;
+#ifdef OTA_NO_GZIP
+  if(otaWritten == 0 && len >= 2 && data[0] == 0x1f && data[1] == 0x8b)
+  {
+    Update.end(); // discard
+    r->status = 415;
+    r->msg = "gzip image needs core 2.7.0+";
+    return;
+  }
+#endif
+  if(otaWritten + len > otaSize || Update.write(data, len) != len)
+  {
+    eventLog.add(LM_Main, LL_Error, LOG_OtaError, Update.getError(), otaWritten);
+    Update.end(); // discard
+    r->status = 500;
+    return;
+  }
+  otaWritten += len;
+
+  if(otaWritten == otaSize)
+  {
+    if(Update.end()) // checks the MD5
+    {
+      eventLog.add(LM_Main, LL_Info, LOG_OtaDone, otaSize);
+      otaRestart = 2;
+    }
+    else
+    {
+      eventLog.add(LM_Main, LL_Error, LOG_OtaError, Update.getError(), otaWritten);
+      r->status = 500;
+    }
+  }
+}
+
+void otaReply(AsyncWebServerRequest *request, int status, const char *pMsg)
+{
+  jsonString js("update");
+  js.Var("offset", otaWritten);
+  js.Var("size", otaSize);
+  js.Var("done", otaRestart != 0);
+  js.Var("error", (int)Update.getError());
+  js.Var("msg", pMsg);
+  request->send(status, "text/json", js.Close());
+}
+
+// Batched settings: fields from one message are staged, validated together,
+// then applied, persisted and broadcast once
+enum settingIdx
+{
+  SET_DelayClose,
+  SET_CloseTimeout,
+  SET_AlarmTimeout,
+  SET_DoorThresh,
+  SET_CarThresh,
+  SET_TempCal,
+  SET_OLED,
+  SET_TZ,
+  SET_Rate,
+  SET_HostPort,
+  SET_Count
+};
+
+const int32_t setLimits[SET_Count][2] = {
+  {0, 3600},  // delayClose
+  {1, 3600},  // closeTimeout
+  {0, 65535}, // alarmTimeout
+  {1, MAX_DISTANCE}, // nDoorThresh
+  {1, MAX_DISTANCE}, // nCarThresh
+  {-100, 100}, // tempCal
+  {0, 1},     // bEnableOLED
+  {-12, 14},  // tz
+  {1, 3600},  // rate
+  {1, 65535}, // hostPort
+};
+
+int32_t  pendVal[SET_Count];
+uint16_t pendMask;     // staged settings
+int8_t   pendBad = -1; // first setting out of range
+int32_t  pendVer = -1; // client's settingsId() for optimistic concurrency
+String   pendRules;
+bool     bPendRules;
+char     pendToken[sizeof(ee.pbToken)];
+bool     bPendToken;
+uint8_t  pendHostIP[4];
+bool     bPendHostIP;
+
+void stageSetting(uint8_t idx, int32_t val)
+{
+  if(val < setLimits[idx][0] || val > setLimits[idx][1])
+  {
+    if(pendBad < 0) pendBad = idx;
+    return;
+  }
+  pendVal[idx] = val;
+  pendMask |= 1 << idx;
+}
+
+void applySetting(uint8_t idx, int32_t val)
+{
+  switch(idx)
+  {
+    case SET_DelayClose:   ee.delayClose = val; break;
+    case SET_CloseTimeout: ee.closeTimeout = val; break;
+    case SET_AlarmTimeout: ee.alarmTimeout = val; break;
+    case SET_DoorThresh:   ee.nDoorThresh = val; break;
+    case SET_CarThresh:    ee.nCarThresh = val; break;
+    case SET_TempCal:      ee.tempCal = val; break;
+    case SET_OLED:
+      ee.bEnableOLED = val ? true:false;
+      if(!ee.bEnableOLED)
+        displayTimer = 0;
+#ifdef USE_OLED
+      display.clear();
+      display.display();
+#endif
+      break;
+    case SET_TZ:           ee.tz = val; break;
+    case SET_Rate:         ee.rate = val; break;
+    case SET_HostPort:     ee.hostPort = val; break;
+  }
+}
+
+// Apply the staged batch, or none of it.  Replies to the WebSocket client if given
+void commitSettings(AsyncWebSocketClient *client)
+{
+  if(pendMask == 0 && pendBad < 0 && pendVer < 0 && !bPendRules && !bPendToken && !bPendHostIP)
+    return;
+
+  String sErr;
+  uint8_t code[RULES_SIZE];
+  int n = 0;
+
+  if(pendBad >= 0)
+    sErr = String("Bad value ") + (int)pendBad;
+  else if(pendVer >= 0 && pendVer != settingsId())
+    sErr = "Settings changed";
+  else if(bPendRules)
+  {
+    n = rules.compile(pendRules.c_str(), code, sizeof(code));
+    if(n < 0)
+    {
+      sErr = String("Rule error at ") + (-n - 1);
+      eventLog.add(LM_Rule, LL_Warn, LOG_RuleError, -n - 1);
+    }
+  }
+
+  if(sErr.length() == 0 && (pendMask || bPendRules || bPendToken || bPendHostIP) )
+  {
+    for(uint8_t i = 0; i < SET_Count; i++)
+      if(pendMask & (1 << i))
+        applySetting(i, pendVal[i]);
+    if(bPendRules)
+    {
+      memcpy(ee.rules, code, n);
+      rules.setCode(ee.rules);
+    }
+    if(bPendToken)
+      memcpy(ee.pbToken, pendToken, sizeof(ee.pbToken));
+    if(bPendHostIP)
+      memcpy(ee.hostIP, pendHostIP, sizeof(ee.hostIP));
+    settingsVer++;
+    ee.update();
+    checkStateVer(); // OLED and temp cal are in dataJson() too
+    String s = settingsJson();
+    heapStat.tag(HT_WsText, s.length());
+    ws.textAll(s);
+    if(bPendHostIP)
+      CallHost(Reason_Setup, ""); // test the new host
+  }
+
+  jsonString js(client ? "batch" : "alert");
+  if(client)
+  {
+    js.Var("ok", sErr.length() == 0);
+    js.Var("ver", (int)settingsId());
+    if(sErr.length())
+      js.Var("text", sErr);
+    client->text(js.Close());
+  }
+  else if(sErr.length())
+  {
+    js.Var("text", sErr);
+    ws.textAll(js.Close());
+  }
+
+  pendMask = 0;
+  pendBad = -1;
+  pendVer = -1;
+  pendRules = "";
+  bPendRules = false;
+  bPendToken = false;
+  bPendHostIP = false;
 }
 
 void displayStart()
@@ -187,11 +702,18 @@ void displayStart()
 
 void parseParams(AsyncWebServerRequest *request)
 {
-  char password[64];
+  char password[64] = "";
  
   if(request->params() == 0)
     return;
 
+  uint8_t nSet = 0;
+  for ( uint8_t i = 0; i < request->params(); i++ )
+    if( !request->getParam(i)->name().equals("wait") )
+      nSet++;
+  if(nSet == 0) // read-only (long-poll), no key needed
+    return;
+
 //  Serial.println("parseParams");
 
   // get password first
@@ -211,23 +733,8 @@ void parseParams(AsyncWebServerRequest *request)
   IPAddress ip = request->client()->remoteIP();
 
   if( ip && ip == verifiedIP ); // can skip if last verified
-  else if( strcmp(password, ee.szControlPassword) || nWrongPass)
-  {
-    if(nWrongPass == 0) // it takes at least 10 seconds to recognize a wrong password
-      nWrongPass = 10;
-    else if((nWrongPass & 0xFFFFF000) == 0 ) // time doubles for every high speed wrong password attempt.  Max 1 hour
-      nWrongPass <<= 1;
-    if(ip != lastIP)  // if different IP drop it down
-       nWrongPass = 10;
-
-    jsonString js("hack");
-    js.Var("ip", ip.toString() );
-    js.Var("pass", password);
-    ws.textAll(js.Close());
-
-    lastIP = ip;
+  else if( badPass(ip, password) )
     return;
-  }
 
   verifiedIP = ip;
   lastIP = ip;
@@ -244,6 +751,12 @@ void parseParams(AsyncWebServerRequest *request)
     "pbt",
     "hostip",
     "port",
+    "rules",
+    "loglevel",
+    "dthresh",
+    "cthresh",
+    "tz",
+    "ver",
     "",
   };
 
@@ -261,16 +774,16 @@ void parseParams(AsyncWebServerRequest *request)
     switch( idx )
     {
       case 0: // close/open delay
-          ee.delayClose = val;
+          stageSetting(SET_DelayClose, val);
           break;
       case 1: // close timeout (set a bit higher than it takes to close)
-          ee.closeTimeout = val;
+          stageSetting(SET_CloseTimeout, val);
           break;
       case 2: // alarm timeout
-          ee.alarmTimeout = val;
+          stageSetting(SET_AlarmTimeout, val);
           break;
       case 3: // temp offset
-          ee.tempCal = val;
+          stageSetting(SET_TempCal, val);
           break;
       case 4: // Door (pulse the output)
           displayStart();
@@ -278,65 +791,59 @@ void parseParams(AsyncWebServerRequest *request)
           else bPulseRemote = true;
           break;
       case 5: // OLED
-        ee.bEnableOLED = (s == "true") ? true:false;
-        if(!ee.bEnableOLED)
-          displayTimer = 0;
-#ifdef USE_OLED
-        display.clear();
-        display.display();
-#endif
+        stageSetting(SET_OLED, (s == "true") ? 1:0);
         break;
       case 6: // WS/event update rate
-        ee.rate = val;
+        stageSetting(SET_Rate, val);
         break;
       case 7: // reset
         ESP.reset();
         break;
       case 8: // pushbullet
-        s.toCharArray( ee.pbToken, sizeof(ee.pbToken) );
+        s.toCharArray( pendToken, sizeof(pendToken) );
+        bPendToken = true;
         break;
-      case 9:
+      case 9: // host IP, or a port on the caller's IP
         if(s.length() > 9)
         {
-          ee.hostPort = 80;
-          ip.fromString(s.c_str());
+          stageSetting(SET_HostPort, 80);
+          if(!ip.fromString(s.c_str()))
+          {
+            if(pendBad < 0) pendBad = SET_HostPort;
+            break;
+          }
         }
         else
-          ee.hostPort = val ? val:80;
-        ee.hostIP[0] = ip[0];
-        ee.hostIP[1] = ip[1];
-        ee.hostIP[2] = ip[2];
-        ee.hostIP[3] = ip[3];
-        CallHost(Reason_Setup, ""); // test
+          stageSetting(SET_HostPort, val ? val:80);
+        for(uint8_t j = 0; j < 4; j++)
+          pendHostIP[j] = ip[j];
+        bPendHostIP = true;
         break;
       case 10:
-        ee.hostPort = val ? val:80;
+        stageSetting(SET_HostPort, val ? val:80);
+        break;
+      case 11:
+        pendRules = s;
+        bPendRules = true;
+        break;
+      case 12: // module << 4 | level
+        eventLog.setLevel(val >> 4, val & 15);
+        break;
+      case 13:
+        stageSetting(SET_DoorThresh, val);
+        break;
+      case 14:
+        stageSetting(SET_CarThresh, val);
+        break;
+      case 15:
+        stageSetting(SET_TZ, val);
+        break;
+      case 16: // expected settings version
+        pendVer = val;
         break;
     }
   }
-}
-
-// Time in hh:mm[:ss][AM/PM]
-String timeFmt(bool do_sec, bool do_M)
-{
-  String r = "";
-  if(hourFormat12() < 10) r = " ";
-  r += hourFormat12();
-  r += ":";
-  if(minute() < 10) r += "0";
-  r += minute();
-  if(do_sec)
-  {
-    r += ":";
-    if(second() < 10) r += "0";
-    r += second();
-    r += " ";
-  }
-  if(do_M)
-  {
-      r += isPM() ? "PM":"AM";
-  }
-  return r;
+  commitSettings(NULL);
 }
 
 const char *jsonList1[] = {
@@ -350,6 +857,10 @@ const char *jsonList1[] = {
   "tempOffset",
   "oled",
   "TZ",
+  "rules",
+  "logLevel",
+  "rate",
+  "ver",
   NULL
 };
 
@@ -368,19 +879,19 @@ void jsonCallback(int16_t iName, int iValue, char *psValue)
         bKeyGood = true;
       break;
     case 1: // doorDelay
-      ee.delayClose = iValue;
+      stageSetting(SET_DelayClose, iValue);
       break;
     case 2: // closeTimeout
-      ee.closeTimeout = iValue;
+      stageSetting(SET_CloseTimeout, iValue);
       break;
     case 3:
-      ee.alarmTimeout = iValue;
+      stageSetting(SET_AlarmTimeout, iValue);
       break;
     case 4: // threshDoor
-      ee.nDoorThresh = iValue;
+      stageSetting(SET_DoorThresh, iValue);
       break;
     case 5: // threshCar
-      ee.nCarThresh = iValue;
+      stageSetting(SET_CarThresh, iValue);
       break;
     case 6: // Door
       displayStart();
@@ -388,13 +899,26 @@ void jsonCallback(int16_t iName, int iValue, char *psValue)
       else bPulseRemote = true; // start output pulse
       break;
     case 7: // tempOffset
-      ee.tempCal = iValue;
+      stageSetting(SET_TempCal, iValue);
       break;
     case 8: // OLED
-      ee.bEnableOLED = iValue ? true:false;
+      stageSetting(SET_OLED, iValue ? 1:0);
       break;
     case 9: // TZ
-      ee.tz = iValue;
+      stageSetting(SET_TZ, iValue);
+      break;
+    case 10: // rules
+      pendRules = psValue;
+      bPendRules = true;
+      break;
+    case 11: // logLevel (module << 4 | level)
+      eventLog.setLevel(iValue >> 4, iValue & 15);
+      break;
+    case 12: // rate
+      stageSetting(SET_Rate, iValue);
+      break;
+    case 13: // ver (expected settingsId)
+      pendVer = iValue;
       break;
   }
 }
@@ -413,6 +937,7 @@ void jsonPushCallback(int16_t iEvent, uint16_t iName, int iValue, char *psValue)
     case -1: // status
       if(iName >= JC_TIMEOUT)
       {
+        eventLog.add(LM_Host, LL_Warn, LOG_HostFail, iName, failCnt + 1);
         if(++failCnt > 5)
           ESP.restart();
       }
@@ -453,16 +978,35 @@ void CallHost(reportReason r, String sStr)
       sUri += "\"";
       break;
     case Reason_Motion:
-      sUri += "motion";
+      sUri += "motion&age="; // ms since the edge
+      sUri += sStr;
       break;
   }
 
   IPAddress ip(ee.hostIP);
   String url = ip.toString();
+  heapStat.tag(HT_CallHost, sUri.length() + url.length());
   jsonPush.begin(url.c_str(), sUri.c_str(), ee.hostPort, false, false, NULL, NULL);
   jsonPush.addList(jsonListPush);
 }
 
+void onLogEvent(AsyncWebSocket * server, AsyncWebSocketClient * client, AwsEventType type, void * arg, uint8_t *data, size_t len)
+{
+  if(type != WS_EVT_CONNECT)
+    return;
+
+  String s; // backlog in one message, loop() streams the rest
+  char szLog[80];
+  uint32_t pos = eventLog.oldest();
+  while(pos < logPos && eventLog.format(pos, szLog, sizeof(szLog)) )
+  {
+    s += szLog;
+    s += "\n";
+  }
+  if(s.length())
+    client->text(s);
+}
+
 void onWsEvent(AsyncWebSocket * server, AsyncWebSocketClient * client, AwsEventType type, void * arg, uint8_t *data, size_t len)
 {  //Handle WebSocket event
   static bool bRestarted = true;
@@ -499,7 +1043,10 @@ void onWsEvent(AsyncWebSocket * server, AsyncWebSocketClient * client, AwsEventT
           bKeyGood = (ip && verifiedIP == ip) ? true:false; // if this IP sent a good key, no need for more
           jsonParse.process((char*)data);
           if(bKeyGood)
+          {
             verifiedIP = ip;
+            commitSettings(client); // whole message is one transaction
+          }
         }
       }
       break;
@@ -508,7 +1055,8 @@ void onWsEvent(AsyncWebSocket * server, AsyncWebSocketClient * client, AwsEventT
 
 void setup()
 {
-  pinMode(MOTION, INPUT);
+  bootNonce = RANDOM_REG32;
+  inMotion = inputs.add(MOTION, 20, 1000); // 20ms debounce, 1s retrigger hold-off
   pinMode(ESP_LED, OUTPUT);
   pinMode(REMOTE, OUTPUT);
   pinMode(SWITCH, OUTPUT);
@@ -532,22 +1080,24 @@ void setup()
   Serial.println();
   Serial.println();
 #endif
+  eventLog.add(LM_Main, LL_Info, LOG_Boot, ESP.getResetInfoPtr()->reason);
 
   WiFi.hostname(hostName);
+  WiFi.persistent(false); // credentials are in ee, don't rewrite the SDK's flash copy on every begin/disconnect
   WiFi.mode(WIFI_STA);
+  gotIPHandler = WiFi.onStationModeGotIP([](const WiFiEventStationModeGotIP &e){ bGotIP = true; });
 
   if ( ee.szSSID[0] )
   {
-    WiFi.begin(ee.szSSID, ee.szSSIDPassword);
+    wifiConnect(ee.wifiChannel ? CS_Fast : CS_Scan);
     WiFi.setHostname(hostName);
     bConfigDone = true;
   }
   else
   {
-    Serial.println("No SSID. Waiting for EspTouch.");
+    eventLog.add(LM_WiFi, LL_Info, LOG_NoSSID);
     WiFi.beginSmartConfig();
   }
-  connectTimer = now();
 
 #ifdef USE_SPIFFS
   SPIFFS.begin();
@@ -557,6 +1107,8 @@ void setup()
   // attach AsyncWebSocket
   ws.onEvent(onWsEvent);
   server.addHandler(&ws);
+  logWs.onEvent(onLogEvent);
+  server.addHandler(&logWs);
 
   server.on( "/", HTTP_GET | HTTP_POST, [](AsyncWebServerRequest *request){
     bDataMode = false; // turn off numeric display and frequent updates
@@ -587,16 +1139,73 @@ void setup()
     page += WiFi.localIP().toString();
     page += ":";
     page += serverPort;
-    page += "\"}";
+    page += "\", \"boot\": ";
+    page += bootTime;
+    page += ", \"stage\": ";
+    page += connStage;
+    page += "}";
     request->send( 200, "text/json", page );
   });
   server.on( "/json", HTTP_GET | HTTP_POST, [](AsyncWebServerRequest *request){
     parseParams(request);
-    request->send( 200, "text/json", settingsJson() );
+    handleVersioned(request, true);
+  });
+  server.on( "/state", HTTP_GET, [](AsyncWebServerRequest *request){
+    handleVersioned(request, false);
+  });
+#ifdef USE_TRACE
+  server.on("/trace.bin", HTTP_GET, [](AsyncWebServerRequest *request){
+    if(request->hasParam("clear"))
+    {
+      trace.clear();
+      request->send(200, "text/plain", "OK");
+      return;
+    }
+    trace.pause(true); // freeze the ring until the client is done
+    AsyncWebServerResponse *response = request->beginResponse("application/octet-stream", trace.size(),
+      [](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+        return trace.read(buffer, maxLen, index);
+      });
+    response->addHeader("Content-Disposition", "attachment; filename=trace.bin");
+    request->onDisconnect([](){ trace.pause(false); });
+    request->send(response);
+  });
+#endif
+  server.on("/update", HTTP_POST, [](AsyncWebServerRequest *request){
+    otaReq *r = (otaReq *)request->_tempObject;
+    if(otaOwner == request)
+      otaOwner = NULL;
+    if(r)
+      otaReply(request, r->status, r->msg);
+    else
+      otaReply(request, 400, "no body");
+  }, NULL, otaBody);
+  server.on("/update", HTTP_GET, [](AsyncWebServerRequest *request){
+    otaReply(request, 200, "");
+  });
+  server.on("/log.txt", HTTP_GET, [](AsyncWebServerRequest *request){
+    uint32_t pos = eventLog.oldest();
+    AsyncWebServerResponse *response = request->beginChunkedResponse("text/plain",
+      [pos](uint8_t *buffer, size_t maxLen, size_t index) mutable -> size_t {
+        size_t len = 0;
+        while(maxLen - len > 82 || (len == 0 && maxLen > 1) ) // room for a line
+        {
+          int n = eventLog.format(pos, (char*)buffer + len, maxLen - len - 1);
+          if(n == 0)
+            break;
+          len += n;
+          buffer[len++] = '\n';
+        }
+        return len;
+      });
+    request->send(response);
   });
   server.on("/heap", HTTP_GET, [](AsyncWebServerRequest *request){
     request->send(200, "text/plain", String(ESP.getFreeHeap()));
   });
+  server.on("/heap.json", HTTP_GET, [](AsyncWebServerRequest *request){
+    request->send(200, "text/json", heapStat.json());
+  });
   server.on("/favicon.ico", HTTP_GET, [](AsyncWebServerRequest *request){
     AsyncWebServerResponse *response = request->beginResponse_P(200, "image/x-icon", favicon, sizeof(favicon));
     response->addHeader("Content-Encoding", "gzip");
@@ -620,15 +1229,48 @@ void setup()
 #endif
 
   jsonParse.setList(jsonList1);
+  rules.setCode(ee.rules);
+  bMotion = inputs.level(inMotion);
+  rules.update(RV_Motion, bMotion);
   digitalWrite(ESP_LED, HIGH);
   if(ee.rate == 0) ee.rate = 60;
 }
 
 uint16_t stateTimer = ee.rate;
 
+struct stateSnap // what dataJson() reports, minus the clock and raw sensor values
+{
+  int16_t temp, rh;
+  bool    bDoor, bCar, bMotion, bOLED;
+};
+stateSnap lastSnap;
+
+// Only a real change moves the /state ETag (not the keepalive)
+void checkStateVer()
+{
+  stateSnap snap;
+  memset(&snap, 0, sizeof(snap));
+  snap.bDoor = bDoorOpen;
+  snap.bCar = bCarIn;
+  snap.bMotion = bMotion;
+  snap.bOLED = ee.bEnableOLED;
+  snap.temp = temp + ee.tempCal;
+  snap.rh = rh;
+  if(memcmp(&snap, &lastSnap, sizeof(snap)))
+  {
+    lastSnap = snap;
+    stateVer++;
+  }
+}
+
 void sendState()
 {
-  ws.textAll(dataJson());
+  checkStateVer();
+  if(bootTime == 0 && bStarted)
+    bootTime = millis();
+  String s = dataJson();
+  heapStat.tag(HT_WsText, s.length());
+  ws.textAll(s);
   stateTimer = ee.rate;
 }
 
@@ -644,6 +1286,28 @@ void loop()
   static bool bReleaseRemote;
   static bool bClear;
 
+  inputEvent ev;
+  while(inputs.read(ev)) // edges captured by interrupt, even if loop was stalled
+  {
+    if(ev.input == inMotion)
+    {
+      bMotion = ev.level;
+      eventLog.add(LM_Main, LL_Debug, LOG_Motion, bMotion, millis() - ev.ms);
+#ifdef USE_TRACE
+      trace.add(TR_MOTION, bMotion, ev.ms);
+#endif
+      if(bMotion)
+      {
+        displayStart();
+        sendState();
+        CallHost(Reason_Motion, String(millis() - ev.ms));
+      }
+      rules.update(RV_Motion, bMotion);
+      ruleInputMs = ev.ms;
+      rules.evaluate();
+    }
+  }
+
   MDNS.update();
 #ifdef OTA_ENABLE
   ArduinoOTA.handle();
@@ -652,44 +1316,54 @@ void loop()
   if(WiFi.status() == WL_CONNECTED && ee.useTime)
     utime.check(ee.tz);
 
-  if(bDataMode && (carVal != oldCarVal || doorVal != oldDoorVal) ) // high speed update
+  checkWaiting();
+
+#ifndef DEBUG
+  if(logWs.count() == 0)
+    logPos = eventLog.head(); // nobody listening, skip formatting
+#endif
+  char szLog[80];
+  while(eventLog.format(logPos, szLog, sizeof(szLog)) )
   {
-    oldCarVal = carVal;
-    oldDoorVal = doorVal;
-    ws.textAll( dataJson() );
+    if(logWs.count())
+      logWs.textAll(szLog);
+#ifdef DEBUG
+    Serial.println(szLog);
+#endif
   }
 
-  if(digitalRead(MOTION) != bMotion)
+  if(bDataMode && (carVal != oldCarVal || doorVal != oldDoorVal) ) // high speed update
   {
-    bMotion = digitalRead(MOTION);
-    if(bMotion)
-    {
-      displayStart();
-      sendState();
-      CallHost(Reason_Motion,"");
-    }
+    oldCarVal = carVal;
+    oldDoorVal = doorVal;
+    stateVer++; // raw values are the point of data mode
+    String s = dataJson();
+    heapStat.tag(HT_WsText, s.length());
+    ws.textAll(s);
   }
 
   if(sec_save != second()) // only do stuff once per second (loop is maybe 20-30 Hz)
   {
     sec_save = second();
 
-    if(!bConfigDone)
+    if(!bConfigDone || connStage == CS_Smart)
     {
       if( WiFi.smartConfigDone())
       {
-        Serial.println("SmartConfig set");
+        eventLog.add(LM_WiFi, LL_Info, LOG_SmartConfigSet);
         bConfigDone = true;
-        connectTimer = now();
+        connStage = CS_Scan; // SmartConfig is already connecting
+        connWait = 10;
       }
     }
     if(bConfigDone)
     {
       if(WiFi.status() == WL_CONNECTED)
       {
+        connWait = 0;
         if(!bStarted)
         {
-          Serial.println("WiFi Connected");
+          eventLog.add(LM_WiFi, LL_Info, LOG_Connected, WiFi.channel(), connStage);
           MDNS.begin( hostName );
           bStarted = true;
 
@@ -700,17 +1374,71 @@ void loop()
           MDNS.addService("iot", "tcp", serverPort);
           WiFi.SSID().toCharArray(ee.szSSID, sizeof(ee.szSSID)); // Get the SSID from SmartConfig or last used
           WiFi.psk().toCharArray(ee.szSSIDPassword, sizeof(ee.szSSIDPassword) );
+          sendState();
+        }
+        if(!bWasConnected) // every (re)connect, the AP may have moved channel or been replaced
+        {
+          bWasConnected = true;
+          memcpy(ee.wifiBSSID, WiFi.BSSID(), sizeof(ee.wifiBSSID)); // cache for the next fast connect
+          ee.wifiChannel = WiFi.channel();
+          ee.update(); // only writes if changed
         }
+        if(connStage == CS_Fast) // the cached address only gets the first connect up
+        {
+          WiFi.config(0U, 0U, 0U); // DHCP takes over and renews the lease
+          connStage = CS_Scan;
+          bGotIP = false;          // the next address is from DHCP
+        }
+        if(bGotIP) // DHCP lease, cache it for the next fast connect
+        {
+          bGotIP = false;
+          copyIP(WiFi.localIP(), ee.wifiIP);
+          copyIP(WiFi.gatewayIP(), ee.wifiGW);
+          copyIP(WiFi.subnetMask(), ee.wifiMask);
+          copyIP(WiFi.dnsIP(), ee.wifiDNS);
+          ee.update();
+        }
+      }
+      else if(connWait == 0) // link dropped after being up
+      {
+        eventLog.add(LM_WiFi, LL_Warn, LOG_LinkLost);
+        bWasConnected = false;
+        wifiConnect(ee.wifiChannel ? CS_Fast : CS_Scan);
       }
-      else if(now() - connectTimer > 10) // failed to connect for some reason
+      else if(--connWait == 0) // stage failed
       {
-        Serial.println("Connect failed. Starting SmartConfig");
-        connectTimer = now();
-        ee.szSSID[0] = 0;
-        WiFi.mode(WIFI_AP_STA);
-        WiFi.beginSmartConfig();
-        bConfigDone = false;
-        bStarted = false;
+        switch(connStage)
+        {
+          case CS_Fast:
+            eventLog.add(LM_WiFi, LL_Warn, LOG_FastFailed);
+            wifiConnect(CS_Scan);
+            break;
+          case CS_Scan:
+            connRetries = 0;
+            wifiConnect(CS_Retry);
+            break;
+          case CS_Retry:
+            if(++connRetries < CONN_RETRIES)
+            {
+              wifiConnect(CS_Retry);
+              eventLog.add(LM_WiFi, LL_Warn, LOG_Retry, connRetries, connWait);
+              break;
+            }
+            eventLog.add(LM_WiFi, LL_Error, LOG_SmartConfig);
+            WiFi.disconnect(); // keeps the stored credentials
+            WiFi.mode(WIFI_AP_STA);
+            WiFi.beginSmartConfig();
+            connStage = CS_Smart;
+            connWait = SMART_WAIT;
+            bStarted = false;
+            break;
+          case CS_Smart: // nothing from EspTouch, the stored AP may be back
+            WiFi.stopSmartConfig();
+            WiFi.mode(WIFI_STA);
+            connRetries = CONN_RETRIES - 1; // one long retry, then SmartConfig again
+            wifiConnect(CS_Retry);
+            break;
+        }
       }
     }
 
@@ -723,6 +1451,7 @@ void loop()
     {
       displayStart();
       bDoorOpen = bNew;
+      eventLog.add(LM_Main, LL_Info, LOG_Door, bDoorOpen, doorVal);
       doorOpenTimer = bDoorOpen ? ee.alarmTimeout : 0;
       sendState();
       CallHost(Reason_Status,"");
@@ -740,6 +1469,7 @@ void loop()
     if(bNew != bCarIn)
     {
       bCarIn = bNew;
+      eventLog.add(LM_Main, LL_Info, LOG_Car, bCarIn, carVal);
       if(bCarIn)
       {
         displayStart();
@@ -769,6 +1499,11 @@ void loop()
       if(am.measure(temp2, rh2))
       {
         digitalWrite(SWITCH, HIGH);
+        bTempValid = true;
+#ifdef USE_TRACE
+        trace.add(TR_TEMP, (1.8 * temp2 + 32.0) * 10);
+        trace.add(TR_RH, rh2 * 10);
+#endif
         tempMedian[0].add( (1.8 * temp2 + 32.0) * 10 );
         tempMedian[0].getAverage(2, temp2);
         tempMedian[1].add(rh2 * 10);
@@ -784,9 +1519,14 @@ void loop()
       display.init();
     }
 
+    heapStat.sample();
+
     if(nWrongPass)
       nWrongPass--;
 
+    if(otaRestart && --otaRestart == 0) // new image, reply has been sent
+      ESP.restart();
+
     if(bReleaseRemote) // reset remote output 1 second after it started
     {
       digitalWrite(REMOTE, LOW);
@@ -804,6 +1544,26 @@ void loop()
       bReleaseRemote = true;
     }
 
+    // Only rules using a changed input are run.  Inputs are fed once valid, so rules
+    // prime on real values and a reboot doesn't fire them
+    if(rangeMedian[1].getCount())
+      rules.update(RV_Door, bDoorOpen);
+    if(rangeMedian[0].getCount())
+      rules.update(RV_Car, bCarIn);
+    if(bTempValid)
+    {
+      rules.update(RV_Temp, temp + ee.tempCal);
+      rules.update(RV_Rh, rh);
+    }
+    if(timeStatus() == timeSet)
+    {
+      rules.update(RV_Hour, hour());
+      rules.update(RV_Min, minute());
+      rules.update(RV_Time, hour() * 100 + minute());
+    }
+    ruleInputMs = millis();
+    rules.evaluate();
+
     if(doorDelay) // delayed close/open
     {
       if(--doorDelay == 0)
@@ -856,6 +1616,9 @@ void loop()
     rangeTime = millis();
     uint16_t ul = sonar[bTog].ping_cm();
     rangeMedian[bTog].add( ul );
+#ifdef USE_TRACE
+    trace.add(TR_SONAR0 + bTog, ul);
+#endif
     bTog = bTog ? 0:1;
   }
 }
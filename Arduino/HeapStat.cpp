@@ -0,0 +1,73 @@
+/*
+  HeapStat.cpp - Heap fragmentation and per-subsystem String output telemetry.
+  Copyright 2016 Greg Cunningham, CuriousTech.net
+*/
+
+#include "HeapStat.h"
+#include "jsonstring.h"
+
+static const char *tagNames[HT_Count] = { "dataJson", "settingsJson", "CallHost", "timeFmt", "PushBullet", "wsText" };
+
+HeapStat::HeapStat()
+{
+  memset(m_calls, 0, sizeof(m_calls));
+  memset(m_outBytes, 0, sizeof(m_outBytes));
+  m_low = 0xFFFFFFFF;
+  for(uint8_t i = 0; i < HEAP_HOURS; i++)
+    m_hourLow[i] = 0xFFFFFFFF;
+  m_hour = 0;
+  m_minBlock = 0xFFFFFFFF;
+  m_maxFrag = 0;
+}
+
+void HeapStat::sample()
+{
+  uint32_t hour = millis() / 3600000;
+  while(m_hour != hour) // start a new hour (millis wraps after 49 days, which also rolls)
+  {
+    m_hour = hour;
+    m_hourLow[m_hour % HEAP_HOURS] = 0xFFFFFFFF;
+  }
+
+  uint32_t heap = ESP.getFreeHeap();
+  uint32_t block = ESP.getMaxFreeBlockSize();
+  uint8_t frag = ESP.getHeapFragmentation();
+
+  if(heap < m_low) m_low = heap;
+  if(heap < m_hourLow[m_hour % HEAP_HOURS]) m_hourLow[m_hour % HEAP_HOURS] = heap;
+  if(block < m_minBlock) m_minBlock = block;
+  if(frag > m_maxFrag) m_maxFrag = frag;
+}
+
+String HeapStat::json()
+{
+  jsonString js("heap");
+
+  js.Var("free", ESP.getFreeHeap());
+  js.Var("block", ESP.getMaxFreeBlockSize());
+  js.Var("frag", (int)ESP.getHeapFragmentation());
+  js.Var("low", m_low);
+  js.Var("minBlock", m_minBlock);
+  js.Var("maxFrag", (int)m_maxFrag);
+
+  uint32_t low24 = 0xFFFFFFFF;
+  uint32_t hourLow[HEAP_HOURS]; // oldest first
+  for(uint8_t i = 0; i < HEAP_HOURS; i++)
+  {
+    hourLow[i] = m_hourLow[(m_hour + 1 + i) % HEAP_HOURS];
+    if(hourLow[i] < low24) low24 = hourLow[i];
+    if(hourLow[i] == 0xFFFFFFFF) hourLow[i] = 0; // no samples
+  }
+  js.Var("low24", low24);
+  js.Array("hourLow", hourLow, HEAP_HOURS);
+
+  String names[HT_Count];
+  for(uint8_t i = 0; i < HT_Count; i++)
+    names[i] = tagNames[i];
+  js.Array("tags", names, HT_Count);
+  js.Array("calls", m_calls, HT_Count);
+  js.Array("outBytes", m_outBytes, HT_Count);
+  return js.Close();
+}
+
+HeapStat heapStat;
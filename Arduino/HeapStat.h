@@ -0,0 +1,51 @@
+/*
+  HeapStat.h - Heap fragmentation and per-subsystem String output telemetry.
+  Copyright 2016 Greg Cunningham, CuriousTech.net
+
+  tag() is called where a subsystem finishes a String: it counts calls and output bytes, not
+  heap allocations (a String may realloc several times while growing; tools/HeapSoak measures that).
+  sample() runs once per second and keeps free heap low-water marks per hour for a day.
+*/
+#ifndef HEAPSTAT_H
+#define HEAPSTAT_H
+
+#include <Arduino.h>
+
+#define HEAP_HOURS 24
+
+enum heapTag
+{
+  HT_DataJson,
+  HT_SettingsJson,
+  HT_CallHost,
+  HT_TimeFmt,
+  HT_PushBullet,
+  HT_WsText,
+  HT_Count
+};
+
+class HeapStat
+{
+public:
+  HeapStat();
+  void tag(uint8_t sub, uint32_t outBytes)
+  {
+    m_calls[sub]++;
+    m_outBytes[sub] += outBytes;
+  }
+  void   sample(void);
+  String json(void);
+
+private:
+  uint32_t m_calls[HT_Count];
+  uint32_t m_outBytes[HT_Count]; // final String lengths
+  uint32_t m_low;               // since boot
+  uint32_t m_hourLow[HEAP_HOURS];
+  uint32_t m_hour;              // hours since boot
+  uint32_t m_minBlock;          // smallest largest-free-block seen
+  uint8_t  m_maxFrag;           // %
+};
+
+extern HeapStat heapStat;
+
+#endif // HEAPSTAT_H
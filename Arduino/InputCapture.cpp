@@ -0,0 +1,112 @@
+/*
+  InputCapture.cpp - Interrupt driven, debounced digital input edges.
+  Copyright 2016 Greg Cunningham, CuriousTech.net
+*/
+
+#include "InputCapture.h"
+
+static InputCapture *pCapture;
+
+static void ICACHE_RAM_ATTR isr0() { pCapture->isr(0); }
+static void ICACHE_RAM_ATTR isr1() { pCapture->isr(1); }
+static void ICACHE_RAM_ATTR isr2() { pCapture->isr(2); }
+static void ICACHE_RAM_ATTR isr3() { pCapture->isr(3); }
+
+static void (*isrList[IC_INPUTS])() = { isr0, isr1, isr2, isr3 };
+
+InputCapture::InputCapture()
+{
+  pCapture = this;
+  m_cnt = 0;
+  m_head = 0;
+  m_tail = 0;
+  m_dropped = 0;
+}
+
+// Returns the input index, or -1 if full
+int8_t InputCapture::add(uint8_t pin, uint16_t debounce, uint16_t holdoff, uint8_t mode)
+{
+  if(m_cnt >= IC_INPUTS)
+    return -1;
+
+  input &in = m_in[m_cnt];
+  pinMode(pin, mode);
+  in.pin = pin;
+  in.debounce = debounce;
+  in.holdoff = holdoff;
+  in.level = digitalRead(pin);
+  in.edge = millis();
+  in.active = in.level ? in.edge : in.edge - holdoff;
+  attachInterrupt(digitalPinToInterrupt(pin), isrList[m_cnt], CHANGE);
+  return m_cnt++;
+}
+
+void ICACHE_RAM_ATTR InputCapture::push(uint8_t n, uint8_t level, uint32_t ms)
+{
+  input &in = m_in[n];
+
+  in.level = level;
+  in.edge = ms;
+  if(level)
+    in.active = ms;
+
+  uint8_t next = (m_head + 1) & (IC_QUEUE - 1);
+  if(next == m_tail) // full, level() is still current
+  {
+    m_dropped++;
+    return;
+  }
+  m_queue[m_head].ms = ms;
+  m_queue[m_head].input = n;
+  m_queue[m_head].level = level;
+  m_head = next;
+}
+
+void ICACHE_RAM_ATTR InputCapture::isr(uint8_t n)
+{
+  input &in = m_in[n];
+  uint32_t ms = millis();
+  uint8_t level = digitalRead(in.pin);
+
+  if(level == in.level || ms - in.edge < in.debounce)
+    return;
+  if(level && ms - in.active < in.holdoff)
+    return;
+  push(n, level, ms);
+}
+
+// Drain one event.  Also reports levels that settled inside a debounce/holdoff window
+bool InputCapture::read(inputEvent &ev)
+{
+  uint32_t ms = millis();
+
+  for(uint8_t n = 0; n < m_cnt; n++)
+  {
+    input &in = m_in[n];
+    uint8_t level = digitalRead(in.pin);
+
+    if(level != in.level && ms - in.edge >= in.debounce && (!level || ms - in.active >= in.holdoff) )
+    {
+      noInterrupts();
+      if(level != in.level) // ISR may have beaten us
+        push(n, level, ms);
+      interrupts();
+    }
+  }
+
+  if(m_tail == m_head)
+    return false;
+  ev = m_queue[m_tail];
+  m_tail = (m_tail + 1) & (IC_QUEUE - 1);
+  return true;
+}
+
+bool InputCapture::level(uint8_t input)
+{
+  return m_in[input].level;
+}
+
+uint16_t InputCapture::dropped()
+{
+  return m_dropped;
+}
@@ -0,0 +1,56 @@
+/*
+  InputCapture.h - Interrupt driven, debounced digital input edges.
+  Copyright 2016 Greg Cunningham, CuriousTech.net
+
+  Edges are timestamped in the GPIO interrupt and queued in a single producer/single consumer
+  ring, so loop() timing only affects when an event is handled, not whether or when it was seen.
+  debounce: changes within this many ms of the last edge are ignored.
+  holdoff: a new active (high) edge is held back until this many ms after the last one.
+  A level that settles during either window is reported once the window ends.
+*/
+#ifndef INPUTCAPTURE_H
+#define INPUTCAPTURE_H
+
+#include <Arduino.h>
+
+#define IC_INPUTS 4
+#define IC_QUEUE  16 // power of 2
+
+struct inputEvent
+{
+  uint32_t ms;    // millis() at the edge
+  uint8_t  input; // index from add()
+  uint8_t  level;
+};
+
+class InputCapture
+{
+public:
+  InputCapture();
+  int8_t   add(uint8_t pin, uint16_t debounce, uint16_t holdoff, uint8_t mode = INPUT);
+  bool     read(inputEvent &ev);
+  bool     level(uint8_t input);
+  uint16_t dropped(void);
+  void     isr(uint8_t n);
+
+private:
+  void     push(uint8_t n, uint8_t level, uint32_t ms);
+
+  struct input
+  {
+    uint8_t  pin;
+    uint16_t debounce;
+    uint16_t holdoff;
+    volatile uint8_t  level; // last reported
+    volatile uint32_t edge;  // ms of last reported edge
+    volatile uint32_t active;// ms of last reported high
+  };
+  input    m_in[IC_INPUTS];
+  uint8_t  m_cnt;
+  inputEvent m_queue[IC_QUEUE];
+  volatile uint8_t  m_head; // written by producer
+  volatile uint8_t  m_tail; // written by read()
+  volatile uint16_t m_dropped;
+};
+
+#endif // INPUTCAPTURE_H
@@ -7,6 +7,8 @@
 
 #include "PushBullet.h"
 #include "jsonstring.h"
+#include "EventLog.h"
+#include "HeapStat.h"
 const char host[] = "api.pushbullet.com";
 const char url[] = "/v2/pushes";
 
@@ -48,8 +50,7 @@ void PushBullet::_onError(AsyncClient* client, int8_t error)
 {
   (void)client;
 
-  Serial.print("PB error ");
-  Serial.println(error);
+  eventLog.add(LM_PB, LL_Error, LOG_PBError, error);
 }
 
 void PushBullet::_onConnect(AsyncClient* client)
@@ -80,6 +81,7 @@ void PushBullet::_onConnect(AsyncClient* client)
   s += data;
   s += "\r\n\r\n";
 
+  heapStat.tag(HT_PushBullet, s.length());
   m_ac.add(s.c_str(), s.length());
 }
 
@@ -0,0 +1,297 @@
+/*
+  Rules.cpp - Small automation rule engine compiled to bytecode.
+  Copyright 2016 Greg Cunningham, CuriousTech.net
+*/
+
+#include "Rules.h"
+
+static const char *varNames[] = { "door", "car", "motion", "temp", "rh", "hour", "min", "time" };
+static const char *opNames[] = { "=", "!=", "<", ">", "<=", ">=" };
+static const int16_t varMin[] = { 0, 0, 0, -1000, 0,    0,  0,    0 }; // temp and rh in tenths, time hhmm
+static const int16_t varMax[] = { 1, 1, 1,  2000, 1000, 23, 59, 2359 };
+static const char *actNames[] = { "pulse", "open", "close", "host", "push", "alert" };
+
+Rules::Rules(void (*callback)(uint8_t action, const char *pText))
+{
+  m_callback = callback;
+  m_pCode = NULL;
+  m_cnt = 0;
+  m_known = 0;
+}
+
+static void skipSpace(const char *&p)
+{
+  while(*p == ' ') p++;
+}
+
+// match one of the names at p, longest first so "<=" wins over "<"
+static int matchName(const char *&p, const char **pNames, int n)
+{
+  int best = -1;
+  int bestLen = 0;
+
+  for(int i = 0; i < n; i++)
+  {
+    int len = strlen(pNames[i]);
+    if(len > bestLen && !strncmp(p, pNames[i], len))
+    {
+      best = i;
+      bestLen = len;
+    }
+  }
+  p += bestLen;
+  return best;
+}
+
+// Compile source to bytecode.  Returns bytes used, or -(offset + 1) of the error
+int Rules::compile(const char *pSrc, uint8_t *pCode, int size)
+{
+  const char *p = pSrc;
+  int len = 0;
+  int rules = 0;
+
+  while(*p)
+  {
+    skipSpace(p);
+    if(*p == ';')
+    {
+      p++;
+      continue;
+    }
+    if(*p == 0)
+      break;
+    if(++rules > RULES_MAX)
+      return -(p - pSrc + 1);
+
+    int hdr = len++;
+    uint8_t nConds = 0;
+
+    for(;;) // conditions
+    {
+      skipSpace(p);
+      int var = matchName(p, varNames, RV_Count);
+      skipSpace(p);
+      int op = matchName(p, opNames, 6);
+      skipSpace(p);
+      if(var < 0 || op < 0 || nConds == 15 || len + 3 > size - 1)
+        return -(p - pSrc + 1);
+
+      const char *pVal = p; // range errors point at the value
+      bool bNeg = (*p == '-');
+      if(bNeg) p++;
+      if(!isdigit(*p))
+        return -(p - pSrc + 1);
+      int val = 0;
+      while(isdigit(*p))
+        if((val = val * 10 + (*p++ - '0')) > 9999) // no variable goes this high, stop before overflow
+          return -(pVal - pSrc + 1);
+      if(var == RV_Temp || var == RV_Rh) // tenths
+      {
+        val *= 10;
+        if(*p == '.' && isdigit(p[1]))
+        {
+          val += p[1] - '0';
+          p += 2;
+          while(isdigit(*p)) p++;
+        }
+      }
+      else if(var == RV_Time && *p == ':' && isdigit(p[1])) // hh:mm
+      {
+        p++;
+        int mm = 0;
+        while(isdigit(*p))
+          if((mm = mm * 10 + (*p++ - '0')) > 59)
+            return -(pVal - pSrc + 1);
+        val = val * 100 + mm;
+      }
+      if(bNeg) val = -val;
+      if(val < varMin[var] || val > varMax[var] || (var == RV_Time && val % 100 > 59) )
+        return -(pVal - pSrc + 1);
+
+      pCode[len++] = (var << 3) | op;
+      pCode[len++] = val;
+      pCode[len++] = val >> 8;
+      nConds++;
+
+      skipSpace(p);
+      if(*p != '&')
+        break;
+      p++;
+    }
+
+    if(*p++ != ':')
+      return -(p - pSrc);
+    skipSpace(p);
+    int act = matchName(p, actNames, RA_Count);
+    if(act < 0)
+      return -(p - pSrc + 1);
+    pCode[hdr] = (act << 4) | nConds;
+
+    if(act >= RA_Host)
+    {
+      skipSpace(p);
+      int n = 0;
+      while(p[n] && p[n] != ';' && n < RULE_TEXT)
+        n++;
+      if(len + 1 + n > size - 1)
+        return -(p - pSrc + 1);
+      pCode[len++] = n;
+      memcpy(pCode + len, p, n);
+      len += n;
+      p += n;
+    }
+    skipSpace(p);
+    if(*p && *p != ';')
+      return -(p - pSrc + 1);
+  }
+  pCode[len++] = 0; // end
+  return len;
+}
+
+// Decompile for display
+String Rules::source(const uint8_t *pCode)
+{
+  String s;
+
+  while(*pCode)
+  {
+    uint8_t act = *pCode >> 4;
+    uint8_t nConds = *pCode++ & 15;
+
+    if(s.length()) s += "; ";
+    for(uint8_t i = 0; i < nConds; i++, pCode += 3)
+    {
+      uint8_t var = pCode[0] >> 3;
+      int16_t val = pCode[1] | (pCode[2] << 8);
+
+      if(i) s += " & ";
+      s += varNames[var];
+      s += opNames[pCode[0] & 7];
+      if(var == RV_Temp || var == RV_Rh)
+      {
+        if(val < 0) s += "-";
+        s += abs(val) / 10;
+        s += ".";
+        s += abs(val) % 10;
+      }
+      else if(var == RV_Time)
+      {
+        s += val / 100;
+        s += ":";
+        if(val % 100 < 10) s += "0";
+        s += val % 100;
+      }
+      else
+        s += val;
+    }
+    s += " : ";
+    s += actNames[act];
+    if(act >= RA_Host)
+    {
+      uint8_t n = *pCode++;
+      s += " ";
+      for(uint8_t i = 0; i < n; i++)
+        s += (char)*pCode++;
+    }
+  }
+  return s;
+}
+
+void Rules::setCode(const uint8_t *pCode)
+{
+  m_pCode = pCode;
+  m_cnt = 0;
+  m_state = 0;
+  m_primed = 0;
+  m_changed = 0;
+
+  while(*pCode && m_cnt < RULES_MAX)
+  {
+    uint8_t act = *pCode >> 4;
+    uint8_t nConds = *pCode++ & 15;
+    uint8_t mask = 0;
+
+    for(uint8_t i = 0; i < nConds; i++, pCode += 3)
+      mask |= 1 << (pCode[0] >> 3);
+    if(act >= RA_Host)
+      pCode += *pCode + 1;
+    m_mask[m_cnt++] = mask;
+    m_changed |= mask;
+  }
+}
+
+uint8_t Rules::count()
+{
+  return m_cnt;
+}
+
+void Rules::update(uint8_t var, int16_t val)
+{
+  if((m_known & (1 << var)) && m_vals[var] == val)
+    return;
+  m_vals[var] = val;
+  m_known |= 1 << var;
+  m_changed |= 1 << var;
+}
+
+bool Rules::test(const uint8_t *&p, uint8_t nConds)
+{
+  bool bRes = true;
+
+  for(uint8_t i = 0; i < nConds; i++, p += 3)
+  {
+    int16_t a = m_vals[p[0] >> 3];
+    int16_t b = p[1] | (p[2] << 8);
+
+    switch(p[0] & 7)
+    {
+      case RO_Eq: bRes &= (a == b); break;
+      case RO_Ne: bRes &= (a != b); break;
+      case RO_Lt: bRes &= (a <  b); break;
+      case RO_Gt: bRes &= (a >  b); break;
+      case RO_Le: bRes &= (a <= b); break;
+      case RO_Ge: bRes &= (a >= b); break;
+    }
+  }
+  return bRes;
+}
+
+// Run the rules that use a changed variable
+void Rules::evaluate()
+{
+  if(m_pCode == NULL || m_changed == 0)
+    return;
+
+  const uint8_t *p = m_pCode;
+  for(uint8_t r = 0; r < m_cnt; r++)
+  {
+    uint8_t act = *p >> 4;
+    uint8_t nConds = *p++ & 15;
+    uint8_t bit = 1 << r;
+
+    if((m_mask[r] & m_changed) == 0 || (m_mask[r] & m_known) != m_mask[r])
+    {
+      p += nConds * 3;
+      if(act >= RA_Host)
+        p += *p + 1;
+      continue;
+    }
+
+    bool bRes = test(p, nConds);
+    char szText[RULE_TEXT + 1] = "";
+    if(act >= RA_Host)
+    {
+      uint8_t n = *p++;
+      memcpy(szText, p, n);
+      szText[n] = 0;
+      p += n;
+    }
+
+    if(bRes && !(m_state & bit) && (m_primed & bit) )
+      m_callback(act, szText);
+    m_primed |= bit;
+    if(bRes) m_state |= bit;
+    else m_state &= ~bit;
+  }
+  m_changed = 0;
+}
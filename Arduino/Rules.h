@@ -0,0 +1,84 @@
+/*
+  Rules.h - Small automation rule engine compiled to bytecode.
+  Copyright 2016 Greg Cunningham, CuriousTech.net
+
+  Source: rules separated by ';', each is conditions joined by '&', ':' and an action
+    "door=1 & car=1 & time>=22:00 : close; temp<35 : push Garage is cold"
+  Variables: door car motion temp rh hour min time   Ops: = != < > <= >=
+  Values: door/car/motion 0-1, temp -100.0 to 200.0, rh 0-100.0, hour 0-23, min 0-59, time 0:00-23:59
+  Actions: pulse open close host push alert (the last 3 take the rest of the rule as text)
+
+  Bytecode per rule: header (action << 4 | conditions), conditions as (var << 3 | op, int16),
+  then a length prefixed string for text actions.  A 0 header ends the list.
+
+  Rules fire on a false to true transition and are only evaluated when a variable they
+  use changes.  The first evaluation after loading only primes the state.
+*/
+#ifndef RULES_H
+#define RULES_H
+
+#include <Arduino.h>
+
+#define RULES_SIZE 96  // bytecode bytes kept in eeMem
+#define RULES_MAX  8
+#define RULE_TEXT  32
+
+enum ruleVar
+{
+  RV_Door,
+  RV_Car,
+  RV_Motion,
+  RV_Temp,   // F * 10
+  RV_Rh,     // % * 10
+  RV_Hour,
+  RV_Min,
+  RV_Time,   // hhmm
+  RV_Count
+};
+
+enum ruleOp
+{
+  RO_Eq,
+  RO_Ne,
+  RO_Lt,
+  RO_Gt,
+  RO_Le,
+  RO_Ge,
+};
+
+enum ruleAction
+{
+  RA_Pulse,
+  RA_Open,
+  RA_Close,
+  RA_Host,   // text actions from here
+  RA_Push,
+  RA_Alert,
+  RA_Count
+};
+
+class Rules
+{
+public:
+  Rules(void (*callback)(uint8_t action, const char *pText));
+  int     compile(const char *pSrc, uint8_t *pCode, int size);
+  String  source(const uint8_t *pCode);
+  void    setCode(const uint8_t *pCode);
+  void    update(uint8_t var, int16_t val);
+  void    evaluate(void);
+  uint8_t count(void);
+
+private:
+  bool    test(const uint8_t *&p, uint8_t nConds);
+  void    (*m_callback)(uint8_t action, const char *pText);
+  const uint8_t *m_pCode;
+  int16_t m_vals[RV_Count];
+  uint8_t m_mask[RULES_MAX]; // variables each rule uses
+  uint8_t m_cnt;
+  uint8_t m_changed;
+  uint8_t m_known;
+  uint8_t m_state;           // last result of each rule
+  uint8_t m_primed;          // rules evaluated at least once
+};
+
+#endif // RULES_H
@@ -0,0 +1,157 @@
+/*
+  SensorTrace.cpp - Compact RAM recorder for raw sensor samples.
+  Copyright 2016 Greg Cunningham, CuriousTech.net
+*/
+
+#include "SensorTrace.h"
+
+SensorTrace::SensorTrace()
+{
+  clear();
+}
+
+void SensorTrace::clear()
+{
+  m_tail = 0;
+  m_len = 0;
+  m_bStarted = false;
+  m_bPaused = false;
+  memset(m_last, 0, sizeof(m_last));
+  memset(m_base, 0, sizeof(m_base));
+}
+
+// Stop recording while a download is in progress
+void SensorTrace::pause(bool bPause)
+{
+  m_bPaused = bPause;
+}
+
+void SensorTrace::add(uint8_t ch, int16_t val)
+{
+  add(ch, val, millis());
+}
+
+// Sample taken at ms, e.g. an edge time from InputCapture
+void SensorTrace::add(uint8_t ch, int16_t val, uint32_t ms)
+{
+  if(m_bPaused || ch >= TR_CHANNELS)
+    return;
+
+  if(!m_bStarted)
+  {
+    m_bStarted = true;
+    m_lastMs = m_baseMs = ms;
+  }
+
+  int32_t d = (int32_t)(ms - m_lastMs); // unsigned difference, safe across the millis() wrap
+  if(d < 0) // older than the newest record, deltas can't go back
+    d = 0;
+
+  uint8_t rec[12];
+  uint8_t n = 0;
+  uint32_t dt = d / 10;
+  m_lastMs += dt * 10; // the remainder carries into the next sample
+  uint16_t zz = (uint16_t)(val - m_last[ch]);
+  zz = (zz << 1) ^ ((int16_t)zz >> 15); // zigzag
+
+  if(dt < 31)
+    rec[n++] = (ch << 5) | dt;
+  else
+  {
+    rec[n++] = (ch << 5) | 31;
+    for(; dt >= 0x80; dt >>= 7)
+      rec[n++] = dt | 0x80;
+    rec[n++] = dt;
+  }
+  for(; zz >= 0x80; zz >>= 7)
+    rec[n++] = zz | 0x80;
+  rec[n++] = zz;
+
+  while(TRACE_SIZE - m_len < n)
+    evict();
+
+  uint16_t pos = (m_tail + m_len) % TRACE_SIZE;
+  for(uint8_t i = 0; i < n; i++)
+  {
+    m_buf[pos] = rec[i];
+    if(++pos >= TRACE_SIZE) pos = 0;
+  }
+  m_len += n;
+  m_last[ch] = val;
+}
+
+uint8_t SensorTrace::get(uint16_t pos)
+{
+  return m_buf[pos % TRACE_SIZE];
+}
+
+uint32_t SensorTrace::getVarint(uint16_t &pos)
+{
+  uint32_t v = 0;
+  uint8_t shift = 0;
+  uint8_t b;
+
+  do
+  {
+    b = get(pos++);
+    v |= (uint32_t)(b & 0x7F) << shift;
+    shift += 7;
+  } while(b & 0x80);
+  return v;
+}
+
+// Drop the oldest record, folding it into the base values
+void SensorTrace::evict()
+{
+  uint16_t pos = m_tail;
+  uint8_t tag = get(pos++);
+  uint32_t dt = tag & 31;
+
+  if(dt == 31)
+    dt = getVarint(pos);
+  uint16_t zz = getVarint(pos);
+
+  m_baseMs += dt * 10;
+  m_base[tag >> 5] += (int16_t)((zz >> 1) ^ -(zz & 1));
+
+  m_len -= pos - m_tail;
+  m_tail = pos % TRACE_SIZE;
+}
+
+size_t SensorTrace::size()
+{
+  return TRACE_HDR + m_len;
+}
+
+// Response filler: header followed by the ring contents, oldest first
+size_t SensorTrace::read(uint8_t *buf, size_t maxLen, size_t index)
+{
+  if(index == 0)
+  {
+    uint32_t ms = m_baseMs;
+    uint8_t n = 0;
+
+    memcpy(m_hdr, "GDT1", 4); n += 4;
+    for(uint8_t i = 0; i < 4; i++)
+      m_hdr[n++] = ms >> (i * 8);
+    for(uint8_t ch = 0; ch < TR_CHANNELS; ch++)
+    {
+      m_hdr[n++] = m_base[ch];
+      m_hdr[n++] = m_base[ch] >> 8;
+    }
+    m_hdr[n++] = m_len;
+    m_hdr[n++] = m_len >> 8;
+  }
+
+  size_t total = size();
+  size_t cnt = 0;
+
+  for(; cnt < maxLen && index < total; cnt++, index++)
+  {
+    if(index < TRACE_HDR)
+      buf[cnt] = m_hdr[index];
+    else
+      buf[cnt] = get(m_tail + index - TRACE_HDR);
+  }
+  return cnt;
+}
@@ -0,0 +1,66 @@
+/*
+  SensorTrace.h - Compact RAM recorder for raw sensor samples.
+  Copyright 2016 Greg Cunningham, CuriousTech.net
+
+  Samples are delta-encoded into a ring buffer.  When full, the oldest records are
+  folded into the base values so the download is always a complete trace.
+
+  Download format (little endian):
+    "GDT1"                  magic
+    uint32  base time       ms, time of the state before the first record
+    int16   base[TR_CHANNELS] value of each channel before the first record
+    uint16  length          bytes of records that follow
+    records:
+      uint8   tag           channel << 5 | dt in 10ms units (31 = varint dt follows)
+      [varint dt]
+      varint  zigzag(value - last value of channel)
+
+  Replay with tools/TraceReplay.
+*/
+#ifndef SENSORTRACE_H
+#define SENSORTRACE_H
+
+#include <Arduino.h>
+
+#define TRACE_SIZE   8192 // ring bytes, ~2 bytes per sonar sample
+#define TRACE_HDR    (4 + 4 + 2 * TR_CHANNELS + 2)
+
+enum traceChannel
+{
+  TR_SONAR0, // car
+  TR_SONAR1, // door
+  TR_MOTION,
+  TR_TEMP,   // F * 10
+  TR_RH,     // % * 10
+  TR_CHANNELS
+};
+
+class SensorTrace
+{
+public:
+  SensorTrace();
+  void   add(uint8_t ch, int16_t val);
+  void   add(uint8_t ch, int16_t val, uint32_t ms);
+  void   clear(void);
+  void   pause(bool bPause);
+  size_t size(void);
+  size_t read(uint8_t *buf, size_t maxLen, size_t index);
+
+private:
+  uint8_t  get(uint16_t pos);
+  uint32_t getVarint(uint16_t &pos);
+  void     evict(void);
+
+  uint8_t  m_buf[TRACE_SIZE];
+  uint16_t m_tail;     // oldest record
+  uint16_t m_len;      // used bytes
+  uint32_t m_lastMs;   // time of newest record (ms, whole 10ms steps from the first)
+  uint32_t m_baseMs;   // time before oldest record (ms)
+  int16_t  m_last[TR_CHANNELS];
+  int16_t  m_base[TR_CHANNELS];
+  uint8_t  m_hdr[TRACE_HDR];
+  bool     m_bStarted;
+  bool     m_bPaused;
+};
+
+#endif // SENSORTRACE_H
@@ -2,6 +2,7 @@
 #define EEMEM_H
 
 #include <Arduino.h>
+#include "Rules.h"
 
 #define EESIZE (offsetof(eeMem, end) - offsetof(eeMem, size) )
 
@@ -10,9 +11,8 @@ class eeMem
 public:
   eeMem();
   void update(void);
-private:
-  uint16_t Fletcher16( uint8_t* data, int count);
-public:
+  static uint16_t Fletcher16( uint8_t* data, int count);
+
   uint16_t size = EESIZE;    // if size changes, use defauls
   uint16_t sum = 0xAAAA;           // if sum is diiferent from memory struct, write
   char     szSSID[32] = "";
@@ -31,6 +31,13 @@ public:
   char     szControlPassword[32] =  "password";
   uint8_t  hostIP[4] = {192,168,31,100};
   uint16_t hostPort = 80;
+  uint8_t  wifiBSSID[6] = {0}; // last good AP for fast connect
+  uint8_t  wifiChannel = 0;    // 0 = no fast connect
+  uint8_t  wifiIP[4] = {0};    // last DHCP lease
+  uint8_t  wifiGW[4] = {0};
+  uint8_t  wifiMask[4] = {0};
+  uint8_t  wifiDNS[4] = {0};
+  uint8_t  rules[RULES_SIZE] = {0}; // compiled automation rules
   uint16_t res = 0;
   uint8_t end;
 };
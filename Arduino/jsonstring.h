@@ -74,7 +74,7 @@ public:
     s += "\"";
     s += key;
     s += "\":\"";
-    s += sVal;
+    Esc(sVal);
     s += "\"";
     m_cnt++;
   }
@@ -85,7 +85,7 @@ public:
     s += "\"";
     s += key;
     s += "\":\"";
-    s += sVal;
+    Esc(sVal.c_str());
     s += "\"";
     m_cnt++;
   }
@@ -100,7 +100,7 @@ public:
     {
       if(i) s += ",";
       s += "\"";
-      s += sVal[i];
+      Esc(sVal[i].c_str());
       s += "\"";
     }
     s += "]";
@@ -138,6 +138,26 @@ public:
   }
 
 protected:
+  void Esc(const char *p) // escape quotes, backslashes and control chars
+  {
+    for(; p && *p; p++)
+    {
+      if(*p == '"' || *p == '\\')
+      {
+        s += '\\';
+        s += *p;
+      }
+      else if((uint8_t)*p < ' ')
+      {
+        char hex[8];
+        sprintf(hex, "\\u%04x", *p);
+        s += hex;
+      }
+      else
+        s += *p;
+    }
+  }
+
   String s;
   int m_cnt;
 };
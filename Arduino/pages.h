@@ -126,6 +126,8 @@ background-image: linear-gradient(top, #ff00ff, #ffa0ff);
 <script type="text/javascript">
 a=document.all
 oledon=0
+ver=-1 // settings version the fields were loaded from
+set={}
 function startEvents(){
 ws = new WebSocket("ws://"+window.location.host+"/ws")
 ws.onopen = function(evt) { }
@@ -135,6 +137,8 @@ ws.onmessage = function(evt) {
  d=JSON.parse(evt.data)
  if(d.cmd == 'settings')
  {
+ set=d
+ ver=d.ver
  a.tz.value=d.tz
  a.thd.value=d.dt
  a.thc.value=d.ct
@@ -159,35 +163,36 @@ ws.onmessage = function(evt) {
  {
   alert(d.text)
  }
+ else if(d.cmd == 'batch') // reply to setVars()
+ {
+  ver=d.ver
+  if(!d.ok) alert(d.text)
+ }
 }
 }
 function setVar(varName, value)
 {
  ws.send('{"key":"'+a.myKey.value+'","'+varName+'":'+value+'}')
 }
-function setDDelay()
-{
- setVar('doorDelay', a.dc.value)
-}
-function setATimeout()
+function setVars(v) // one message, applied together or not at all
 {
- setVar('alarmtimeout', a.at.value)
+ s='{"key":"'+a.myKey.value+'"'
+ for(n in v) s+=',"'+n+'":'+v[n]
+ ws.send(s+',"ver":'+ver+'}')
 }
-function setTZ()
+function apply()
 {
- setVar('TZ', a.tz.value)
-}
-function setTh1()
-{
- setVar('threshDoor', a.thd.value)
-}
-function setTh2()
-{
- setVar('threshCar', a.thc.value)
+ v={}
+ if(a.dc.value!=set.delay) v.doorDelay=a.dc.value
+ if(a.thd.value!=set.dt) v.threshDoor=a.thd.value
+ if(a.thc.value!=set.ct) v.threshCar=a.thc.value
+ if(a.at.value!=set.at) v.alarmtimeout=a.at.value
+ if(a.tz.value!=set.tz) v.TZ=a.tz.value
+ if(Object.keys(v).length) setVars(v)
 }
 function oled(){
 oledon=!oledon
-setVar('oled', oledon?1:0)
+setVars({oled:oledon?1:0})
 a.OLED.value=oledon?'ON ':'OFF'
 }
 </script>
@@ -199,17 +204,18 @@ startEvents()
 <div><h3>WiFi Garage Door Opener </h3>
 <table align=center>
 <tr align=center><td><p id="time"> 0:00:00 AM</p></td><td><input type="button" value="Open" id="doorBtn" onClick="{setVar('door',0)}"></td></tr>
-<tr><td><input id='dc' type=text size=4 value='10'><input value="Set" type='button' onClick="{setDDelay()}"></td>
+<tr><td><input id='dc' type=text size=4 value='10'></td>
 <td align=center><input type="button" value="Delayed" id="doorD" onClick="{setVar('door',1)}"></td></tr>
 <tr align=center><td>Garage</td><td>Car</td></tr>
 <tr align=center><td><div id="door">CLOSED</div></td><td><div id="car">IN</div></td></tr>
 <tr align=center><td><div id="dv"></div></td><td><div id="cv"></div></td></tr>
-<tr><td><input id='thd' type=text size=4 value='100'><input value="Set" type='button' onClick="{setTh1()}"></td>
-<td><input id='thc' type=text size=4 value='100'><input value="Set" type='button' onClick="{setTh2()}"></td></tr>
+<tr><td><input id='thd' type=text size=4 value='100'></td>
+<td><input id='thc' type=text size=4 value='100'></td></tr>
 <tr align=center><td>Timeout</td><td>Timezone</td></tr>
-<tr><td><input name='at' id='at' type=text size=4 value='60'><input value="Set" type='button' onclick="{setATimeout()}"></td>
-<td><input name='tz' id='tz' type=text size=4 value='-5'><input value="Set" type='button' onclick="{setTZ()}"></td></tr>
-<tr><td>Display:<input type="button" value="ON" id="OLED" onClick="{oled()}"></td><td align=right><input type="submit" value="Main" onClick="window.location='/iot';"></td></tr>
+<tr><td><input name='at' id='at' type=text size=4 value='60'></td>
+<td><input name='tz' id='tz' type=text size=4 value='-5'></td></tr>
+<tr><td></td><td align=right><input value="Apply" type='button' onClick="{apply()}"></td></tr>
+<tr><td>Display:<input type="button" value="ON" id="OLED" onClick="{oled()}"></td><td align=right><input type="submit" value="Main" onClick="window.location='/';"></td></tr>
 </table>
 <input id="myKey" name="key" type=text size=50 placeholder="password" style="width: 150px"><input type="button" value="Save" onClick="{localStorage.setItem('key', key=document.all.myKey.value)}">
 </div>
@@ -0,0 +1,46 @@
+/*
+  strfmt.h - Small String formatters for the display and JSON (also built by tools/HostTests).
+  Copyright 2016 Greg Cunningham, CuriousTech.net
+*/
+#ifndef STRFMT_H
+#define STRFMT_H
+
+#include <Arduino.h>
+#include <TimeLib.h>
+#include "HeapStat.h"
+
+inline String sDec(int t) // just 123 to 12.3 string
+{
+  String s = (t < 0) ? "-" : "";
+  t = abs(t);
+  s += t / 10;
+  s += ".";
+  s += t % 10;
+  return s;
+}
+
+// Time in hh:mm[:ss][AM/PM]
+inline String timeFmt(bool do_sec, bool do_M)
+{
+  String r = "";
+  if(hourFormat12() < 10) r = " ";
+  r += hourFormat12();
+  r += ":";
+  if(minute() < 10) r += "0";
+  r += minute();
+  if(do_sec)
+  {
+    r += ":";
+    if(second() < 10) r += "0";
+    r += second();
+    r += " ";
+  }
+  if(do_M)
+  {
+      r += isPM() ? "PM":"AM";
+  }
+  heapStat.tag(HT_TimeFmt, r.length());
+  return r;
+}
+
+#endif // STRFMT_H
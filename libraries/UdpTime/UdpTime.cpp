@@ -36,13 +36,18 @@ void UdpTime::start()
 }
 
 void UdpTime::DST() // 2016 starts 2AM Mar 13, ends Nov 6
+{
+  _dst = isDST(now() - _dst * 3600) ? 1:0; // isDST() takes standard time, the clock includes the current _dst
+}
+
+bool UdpTime::isDST(uint32_t t) // US rules for local standard time t
 {
   tmElements_t tm;
-  breakTime(now(), tm);
+  breakTime(t, tm);
   // save current time
   uint8_t m = tm.Month;
   int8_t d = tm.Day;
-  int8_t dow = tm.Wday;
+  uint8_t h = tm.Hour;
 
   tm.Month = 3; // set month = Mar
   tm.Day = 14; // day of month = 14
@@ -56,14 +61,11 @@ void UdpTime::DST() // 2016 starts 2AM Mar 13, ends Nov 6
 
   uint8_t day_of_nov = (7 - tm.Wday) + 1;
 
-  if ((m  >  3 && m < 11 ) ||
+  return ((m  >  3 && m < 11 ) ||
       (m ==  3 && d > day_of_mar) ||
-      (m ==  3 && d == day_of_mar && hour() >= 2) ||  // DST starts 2nd Sunday of March;  2am
+      (m ==  3 && d == day_of_mar && h >= 2) ||  // DST starts 2nd Sunday of March;  2am
       (m == 11 && d <  day_of_nov) ||
-      (m == 11 && d == day_of_nov && hour() < 2))   // DST ends 1st Sunday of November; 2am
-   _dst = 1;
- else
-   _dst = 0;
+      (m == 11 && d == day_of_nov && h < 1));   // DST ends 1st Sunday of November; 2am DST is 1am standard
 }
 
 uint8_t UdpTime::getDST()
@@ -10,6 +10,7 @@ public:
   void start(void);
   bool check(int8_t tz);
   void DST(void);
+  static bool isDST(uint32_t t);
   uint8_t getDST(void);
 private:
 #define NTP_PACKET_SIZE  48 // NTP time stamp is in the first 48 bytes of the message
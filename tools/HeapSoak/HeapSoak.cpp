@@ -0,0 +1,578 @@
+/*
+  HeapSoak.cpp - Replay simulated days of events through the firmware's String paths on a model heap.
+  Copyright 2016 Greg Cunningham, CuriousTech.net
+
+  Build: g++ -O2 -I../HostStubs -I../../Arduino -o HeapSoak HeapSoak.cpp ../../Arduino/Rules.cpp
+           ../../Arduino/HeapStat.cpp
+  Usage: HeapSoak [-d days] [-k heapKB] [-r rate] [-s seed] [-v]
+
+  Each simulated second runs what loop() would build that second: the OLED strings, the state
+  broadcast every rate seconds, a dashboard long-poll, and random motion, door, alarm and
+  settings events, plus network buffers of random size and life.  jsonString, Rules::source,
+  timeFmt() (strfmt.h) and HeapStat are the firmware's own; dataJson(), settingsJson(), CallHost()
+  and the PushBullet request are mirrored from GarageDoor.ino and PushBullet.cpp.  Buffers the
+  async libraries keep (ws messages, host and push requests) are held for their typical life.
+
+  Every String allocation goes to a best-fit heap of 8 byte blocks with a 4 byte header, like
+  umm_malloc, sized to the free heap after setup().  Prints free heap, largest block and
+  fragmentation (ESP.getHeapFragmentation()'s formula) per day, the growth from the first day
+  to the last, and for each path that HeapStat tags its calls and output bytes (from heapStat)
+  with the real allocations per call, copies the async libraries make included.
+*/
+
+#include <Arduino.h>
+#include <math.h>
+#include <time.h>
+#include <map>
+#include <vector>
+#include "jsonstring.h"
+#include "Rules.h"
+#include "HeapStat.h" // heapTag names the paths
+#include "strfmt.h"
+
+class simHeap
+{
+public:
+  void init(uint32_t size)
+  {
+    m_arena.assign(size & ~7, 0);
+    m_free.clear();
+    m_used.clear();
+    m_free[0] = m_arena.size();
+    fails = 0;
+  }
+
+  void *alloc(size_t n)
+  {
+    uint32_t need = blocks(n);
+    auto best = m_free.end();
+    for(auto it = m_free.begin(); it != m_free.end(); ++it) // best fit
+      if(it->second >= need && (best == m_free.end() || it->second < best->second))
+        best = it;
+    if(best == m_free.end())
+    {
+      fails++;
+      return NULL;
+    }
+    uint32_t off = best->first;
+    uint32_t left = best->second - need;
+    m_free.erase(best);
+    if(left)
+      m_free[off + need] = left;
+    m_used[off] = need;
+    return &m_arena[off + 4];
+  }
+
+  void release(void *p)
+  {
+    if(p == NULL)
+      return;
+    uint32_t off = offset(p);
+    uint32_t size = m_used[off];
+    m_used.erase(off);
+    addFree(off, size);
+  }
+
+  void *resize(void *p, size_t n)
+  {
+    if(p == NULL)
+      return alloc(n);
+    if(n == 0)
+    {
+      release(p);
+      return NULL;
+    }
+    uint32_t off = offset(p);
+    uint32_t cur = m_used[off];
+    uint32_t need = blocks(n);
+
+    if(need <= cur) // shrink in place
+    {
+      m_used[off] = need;
+      if(cur > need)
+        addFree(off + need, cur - need);
+      return p;
+    }
+    auto next = m_free.find(off + cur);
+    if(next != m_free.end() && cur + next->second >= need) // grow into the next free block
+    {
+      uint32_t left = cur + next->second - need;
+      m_free.erase(next);
+      if(left)
+        m_free[off + need] = left;
+      m_used[off] = need;
+      return p;
+    }
+    void *pNew = alloc(n);
+    if(pNew)
+    {
+      memcpy(pNew, p, cur - 4);
+      release(p);
+    }
+    return pNew;
+  }
+
+  uint32_t freeHeap()
+  {
+    uint32_t sum = 0;
+    for(auto &f : m_free)
+      sum += f.second;
+    return sum;
+  }
+
+  uint32_t maxBlock()
+  {
+    uint32_t max = 0;
+    for(auto &f : m_free)
+      if(f.second > max) max = f.second;
+    return max ? max - 4 : 0;
+  }
+
+  uint8_t frag()
+  {
+    double sum = 0, sq = 0;
+    for(auto &f : m_free)
+    {
+      sum += f.second;
+      sq += (double)f.second * f.second;
+    }
+    return sum ? 100 - (uint8_t)(sqrt(sq) * 100 / sum) : 0;
+  }
+
+  uint32_t fails;
+
+private:
+  static uint32_t blocks(size_t n) { return (n + 4 + 7) & ~7; }
+  uint32_t offset(void *p) { return (uint8_t *)p - &m_arena[0] - 4; }
+
+  void addFree(uint32_t off, uint32_t size)
+  {
+    auto it = m_free.emplace(off, size).first;
+    auto next = std::next(it);
+    if(next != m_free.end() && it->first + it->second == next->first)
+    {
+      it->second += next->second;
+      m_free.erase(next);
+    }
+    if(it != m_free.begin())
+    {
+      auto prev = std::prev(it);
+      if(prev->first + prev->second == it->first)
+      {
+        prev->second += it->second;
+        m_free.erase(it);
+      }
+    }
+  }
+
+  std::vector<uint8_t> m_arena;
+  std::map<uint32_t, uint32_t> m_free; // offset, bytes
+  std::map<uint32_t, uint32_t> m_used;
+};
+
+static simHeap heap;
+static int curPath = -1;                // heapTag of the code running now
+static uint32_t pathAllocs[HT_Count];   // mallocs, growing reallocs and held copies
+
+static void *soakRealloc(void *p, size_t n)
+{
+  if(curPath >= 0)
+    pathAllocs[curPath]++;
+  return heap.resize(p, n);
+}
+
+static void soakFree(void *p)
+{
+  heap.release(p);
+}
+
+struct held // a buffer an async library keeps after the call returns
+{
+  uint32_t until;
+  void    *p;
+};
+static std::vector<held> heldList;
+
+static void hold(const char *p, size_t len, uint32_t now, uint32_t secs)
+{
+  void *buf = heap.alloc(len + 1);
+  if(curPath >= 0)
+    pathAllocs[curPath]++;
+  if(buf)
+  {
+    if(p)
+      memcpy(buf, p, len);
+    heldList.push_back( {now + secs, buf} );
+  }
+}
+
+static void hold(const String &s, uint32_t now, uint32_t secs)
+{
+  hold(s.c_str(), s.length(), now, secs);
+}
+
+static void releaseHeld(uint32_t now)
+{
+  for(size_t i = 0; i < heldList.size(); )
+  {
+    if(heldList[i].until <= now)
+    {
+      heap.release(heldList[i].p);
+      heldList[i] = heldList.back();
+      heldList.pop_back();
+    }
+    else
+      i++;
+  }
+}
+
+static uint32_t rndState = 1;
+
+static uint32_t rnd(uint32_t n) // xorshift, repeatable for a seed
+{
+  rndState ^= rndState << 13;
+  rndState ^= rndState >> 17;
+  rndState ^= rndState << 5;
+  return rndState % n;
+}
+
+// Firmware state the strings are built from
+struct soakState
+{
+  uint32_t t;
+  bool     bDoorOpen;
+  bool     bCarIn;
+  bool     bMotion;
+  float    temp = 680;
+  float    rh = 450;
+  uint16_t doorVal = 200;
+  uint16_t carVal = 90;
+  uint8_t  rules[RULES_SIZE];
+};
+static soakState st;
+
+static void rulesCallback(uint8_t action, const char *pText) {}
+static Rules rules(rulesCallback);
+
+static String dataJson() // mirrors GarageDoor.ino
+{
+  curPath = HT_DataJson;
+  jsonString js("state");
+
+  js.Var("t", st.t);
+  js.Var("door", st.bDoorOpen);
+  js.Var("car", st.bCarIn);
+  js.Var("temp", String(st.temp/10, 1) );
+  js.Var("rh", String(st.rh/10, 1) );
+  js.Var("o", true);
+  js.Var("carVal", st.carVal);
+  js.Var("doorVal", st.doorVal);
+  js.Var("motion", st.bMotion);
+  String s = js.Close();
+  heapStat.tag(HT_DataJson, s.length());
+  curPath = -1;
+  return s;
+}
+
+static String settingsJson() // mirrors GarageDoor.ino
+{
+  curPath = HT_SettingsJson;
+  jsonString js("settings");
+
+  js.Var("ct", 150);
+  js.Var("dt", 150);
+  js.Var("tz", -5);
+  js.Var("at", 300);
+  js.Var("clt", 60);
+  js.Var("delay", 10);
+  js.Var("rt", 55);
+  String s = String(192);
+  s += ".";
+  s += String(168);
+  s += ".";
+  s += String(31);
+  s += ".";
+  s += String(100);
+  js.Var("host", s);
+  js.Var("rt", 55);
+  js.Var("rules", rules.source(st.rules) );
+  js.Var("ver", 0x12340005);
+  String sJs = js.Close();
+  heapStat.tag(HT_SettingsJson, sJs.length());
+  curPath = -1;
+  return sJs;
+}
+
+static String oledTime() // the firmware's timeFmt(), with its allocations counted
+{
+  curPath = HT_TimeFmt;
+  String r = timeFmt(true, true);
+  curPath = -1;
+  return r;
+}
+
+static void wsText(const String &s, uint32_t now) // ws.textAll() copies into a shared message
+{
+  curPath = HT_WsText;
+  heapStat.tag(HT_WsText, s.length());
+  hold(s, now, 1);
+  hold(NULL, 40, now, 1); // per client message objects
+  hold(NULL, 40, now, 1);
+  curPath = -1;
+}
+
+static void callHost(const char *pReason, const String &sArg, uint32_t now) // mirrors CallHost()
+{
+  curPath = HT_CallHost;
+  String sUri = String("/wifi?name=\"GDO\"&reason=");
+  sUri += pReason;
+  sUri += sArg;
+  String url = String(192);
+  url += ".";
+  url += 168;
+  url += ".";
+  url += 31;
+  url += ".";
+  url += 100;
+  heapStat.tag(HT_CallHost, sUri.length() + url.length());
+  hold(sUri, now, 2); // JsonClient keeps the path until connected
+  hold(url, now, 2);
+  curPath = -1;
+}
+
+static void pushBullet(const char *pBody, uint32_t now) // mirrors PushBullet::_onConnect()
+{
+  curPath = HT_PushBullet;
+  jsonString js;
+  js.Var("type", "note");
+  js.Var("title", "GDO");
+  js.Var("body", pBody);
+  String data = js.Close();
+
+  String s = String("POST ");
+  s += "/v2/pushes";
+  s += " HTTP/1.1\r\n";
+  s += "Host: ";
+  s += "api.pushbullet.com";
+  s += "\r\n"
+       "Content-Type: application/json\r\n"
+       "Access-Token: ";
+  s += "o.0123456789abcdef0123456789abcdef";
+  s += "\r\n"
+       "User-Agent: Arduino\r\n"
+       "Content-Length: ";
+  s += data.length();
+  s += "\r\n"
+       "Connection: close\r\n\r\n";
+  s += data;
+  s += "\r\n\r\n";
+  heapStat.tag(HT_PushBullet, s.length());
+  hold(s, now, 3); // TLS connect and send
+  curPath = -1;
+}
+
+static void sendState(uint32_t now)
+{
+  String s = dataJson();
+  wsText(s, now);
+}
+
+static void jsonArray(const String &js, const char *pKey, uint32_t *p, int n) // "key":[a,b,...]
+{
+  const char *s = strstr(js.c_str(), (String("\"") + pKey + "\":[").c_str());
+  memset(p, 0, n * sizeof(uint32_t));
+  if(s == NULL)
+    return;
+  s = strchr(s, '[');
+  for(int i = 0; i < n && *s != ']'; i++)
+    p[i] = strtoul(s + 1, (char **)&s, 10);
+}
+
+static void draw(String s) // display.drawPropString() takes a String
+{
+}
+
+struct dayStats
+{
+  uint32_t low = 0xFFFFFFFF;
+  uint32_t minBlock = 0xFFFFFFFF;
+  uint8_t  maxFrag = 0;
+  double   fragSum = 0;
+  uint32_t samples = 0;
+  uint32_t events = 0;
+};
+
+static void usage()
+{
+  fprintf(stderr, "Usage: HeapSoak [-d days] [-k heapKB] [-r rate] [-s seed] [-v]\n");
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  int days = 30;
+  int heapKB = 28;
+  int rate = 55;
+  bool bVerbose = false;
+  uint32_t seed = 1;
+
+  for(int i = 1; i < argc; i++)
+  {
+    if(!strcmp(argv[i], "-v"))
+    {
+      bVerbose = true;
+      continue;
+    }
+    if(argv[i][0] != '-' || i + 1 >= argc)
+      usage();
+    int val = atoi(argv[++i]);
+    switch(argv[i - 1][1])
+    {
+      case 'd': days = val; break;
+      case 'k': heapKB = val; break;
+      case 'r': rate = val; break;
+      case 's': seed = val ? val : 1; break;
+      default: usage();
+    }
+  }
+  if(days <= 0 || heapKB <= 0 || rate <= 0)
+    usage();
+
+  if(rules.compile("door=1 & time>=22:00 : close; temp<35 : push Garage is cold; motion=1 & hour<6 : host motion", st.rules, RULES_SIZE) < 0)
+  {
+    fprintf(stderr, "rule compile failed\n");
+    return 1;
+  }
+
+  rndState = seed;
+  heap.init(heapKB * 1024);
+  hostRealloc = soakRealloc;
+  hostFree = soakFree;
+
+  uint32_t start = heap.freeHeap();
+  std::vector<dayStats> stats(days);
+  clock_t c = clock();
+  uint32_t stateTimer = rate;
+  uint32_t displayTimer = 0;
+
+  for(st.t = 0; st.t < (uint32_t)days * 86400; st.t++)
+  {
+    uint32_t now = st.t;
+    dayStats &d = stats[now / 86400];
+    uint32_t hour = now % 86400 / 3600;
+    bool bDay = (hour >= 7 && hour < 22);
+    hostMillis = now * 1000;
+    setTime(now);
+
+    releaseHeld(now);
+
+    for(uint32_t n = rnd(4); n; n--) // network buffers
+      hold(NULL, 64 + rnd(1400), now, 1 + rnd(3));
+
+    if(rnd(86400) < (bDay ? 60u : 6u)) // motion edges per day
+    {
+      st.bMotion = !st.bMotion;
+      d.events++;
+      if(st.bMotion)
+      {
+        displayTimer = 30;
+        sendState(now);
+        callHost("motion&age=", String(rnd(50)), now);
+      }
+    }
+    if(rnd(86400) < (bDay ? 12u : 1u)) // door
+    {
+      st.bDoorOpen = !st.bDoorOpen;
+      st.doorVal = st.bDoorOpen ? 40 : 200;
+      d.events++;
+      sendState(now);
+      String s = "status&door=";
+      s += st.bDoorOpen;
+      s += "&car=";
+      s += st.bCarIn;
+      callHost("", s, now);
+      if(st.bDoorOpen && rnd(4) == 0)
+      {
+        st.bCarIn = !st.bCarIn;
+        st.carVal = st.bCarIn ? 90 : 300;
+      }
+    }
+    if(rnd(86400 * 3) == 0) // door left open alarm
+    {
+      d.events++;
+      callHost("alert&value=", String("\"Door not closed\""), now);
+      wsText(String("{\"cmd\":\"alert\",\"text\":\"Door not closed\"}"), now);
+      pushBullet("Door not closed", now);
+    }
+    if(rnd(86400) < 3) // settings page load
+    {
+      d.events++;
+      wsText(settingsJson(), now);
+    }
+    if(now % 60 == 0) // AM2320 drift
+    {
+      st.temp += (int)rnd(5) - 2;
+      st.rh += (int)rnd(5) - 2;
+    }
+    if(now % 30 == 0) // dashboard long-poll reply
+    {
+      String s = dataJson();
+      hold(s, now, 1);
+      hold(NULL, 120, now, 1); // response object
+    }
+    if(--stateTimer == 0)
+    {
+      sendState(now);
+      stateTimer = rate;
+    }
+    if(displayTimer)
+      displayTimer--;
+
+    draw(oledTime()); // OLED is on by default
+    draw(st.bDoorOpen ? "Open" : "Closed");
+    draw(st.bCarIn ? "In" : "Out");
+    draw(String(st.temp/10, 1) + "]");
+    draw(String(st.rh/10, 1) + "%");
+
+    uint32_t free = heap.freeHeap();
+    uint32_t block = heap.maxBlock();
+    uint8_t frag = heap.frag();
+    if(free < d.low) d.low = free;
+    if(block < d.minBlock) d.minBlock = block;
+    if(frag > d.maxFrag) d.maxFrag = frag;
+    d.fragSum += frag;
+    d.samples++;
+  }
+
+  double wall = (double)(clock() - c) / CLOCKS_PER_SEC;
+
+  printf("%d days, %u byte heap, state every %d s, seed %u\n", days, start, rate, seed);
+  printf("day  events  low free  min block  avg frag  max frag\n");
+  for(int i = 0; i < days; i++)
+  {
+    const dayStats &d = stats[i];
+    if(bVerbose || i == 0 || i == days - 1 || (i + 1) % 7 == 0)
+      printf("%3d  %6u  %8u  %9u  %7.1f%%  %7u%%\n", i + 1, d.events, d.low, d.minBlock, d.fragSum / d.samples, d.maxFrag);
+  }
+  const dayStats &first = stats[0];
+  const dayStats &last = stats[days - 1];
+  printf("growth: avg frag %+.1f%%, max frag %+d%%, min block %+d bytes, low free %+d bytes\n",
+    last.fragSum / last.samples - first.fragSum / first.samples, last.maxFrag - first.maxFrag,
+    (int)(last.minBlock - first.minBlock), (int)(last.low - first.low));
+  printf("allocation failures %u\n\n", heap.fails);
+
+  hostRealloc = realloc; // the soak is over, the report doesn't go on the model heap
+  hostFree = free;
+  String hs = heapStat.json();
+  uint32_t pathCalls[HT_Count], pathOutBytes[HT_Count];
+  jsonArray(hs, "calls", pathCalls, HT_Count);
+  jsonArray(hs, "outBytes", pathOutBytes, HT_Count);
+
+  static const char *pathNames[HT_Count] = { "dataJson", "settingsJson", "CallHost", "timeFmt", "PushBullet", "wsText" };
+  printf("path           calls   allocs  per call  outBytes\n");
+  for(int i = 0; i < HT_Count; i++)
+    printf("%-12s %7u %8u %9.1f %9u\n", pathNames[i], pathCalls[i], pathAllocs[i],
+      pathCalls[i] ? (double)pathAllocs[i] / pathCalls[i] : 0.0, pathOutBytes[i]);
+  printf("\nsoak %.2f s (%.0f simulated days per second)\n", wall, wall > 0 ? days / wall : 0.0);
+  return 0;
+}
@@ -0,0 +1,187 @@
+/*
+  Arduino.h - Minimal host stand-in for building firmware modules into the tools.
+  Copyright 2016 Greg Cunningham, CuriousTech.net
+
+  Use with -I../HostStubs.  String follows the esp8266 2.5.0 WString: no small string
+  buffer, capacity rounded up to 16, realloc on growth.  Its allocations go through
+  hostRealloc/hostFree so a tool can put them on a simulated heap.  millis() returns
+  hostMillis, which the tool advances (delay() adds to it).
+*/
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <math.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define F(s) (s)
+#define snprintf_P snprintf
+#define strcpy_P strcpy
+#define memcpy_P memcpy
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+
+inline uint32_t hostMillis;
+inline unsigned long millis() { return hostMillis; }
+inline void delay(unsigned long ms) { hostMillis += ms; }
+inline uint16_t word(uint8_t h, uint8_t l) { return h << 8 | l; }
+
+class EspClass // heap queries for HeapStat, no heap to report on the host
+{
+public:
+  uint32_t getFreeHeap() { return 0; }
+  uint32_t getMaxFreeBlockSize() { return 0; }
+  uint8_t  getHeapFragmentation() { return 0; }
+};
+inline EspClass ESP;
+
+inline void *(*hostRealloc)(void *p, size_t n) = realloc;
+inline void (*hostFree)(void *p) = free;
+
+class String
+{
+public:
+  String(const char *cstr = "") { init(); if(cstr) copy(cstr, strlen(cstr)); }
+  String(const String &str) { init(); *this = str; }
+  String(String &&rval) { init(); move(rval); }
+  explicit String(char c) { char buf[2] = {c, 0}; init(); *this = buf; }
+  explicit String(int value) { init(); num("%d", value); }
+  explicit String(unsigned int value) { init(); num("%u", value); }
+  explicit String(long value) { init(); num("%ld", value); }
+  explicit String(unsigned long value) { init(); num("%lu", value); }
+  explicit String(float value, unsigned char decimals = 2) { init(); dec(value, decimals); }
+  explicit String(double value, unsigned char decimals = 2) { init(); dec(value, decimals); }
+  ~String() { hostFree(buffer); }
+
+  String &operator=(const String &rhs)
+  {
+    if(this == &rhs) return *this;
+    if(rhs.buffer) copy(rhs.buffer, rhs.len);
+    else invalidate();
+    return *this;
+  }
+  String &operator=(String &&rval) { if(this != &rval) move(rval); return *this; }
+  String &operator=(const char *cstr)
+  {
+    if(cstr) copy(cstr, strlen(cstr));
+    else invalidate();
+    return *this;
+  }
+
+  bool reserve(unsigned int size)
+  {
+    if(buffer && capacity >= size) return true;
+    if(!changeBuffer(size)) return false;
+    if(len == 0) buffer[0] = 0;
+    return true;
+  }
+
+  bool concat(const char *cstr, unsigned int length)
+  {
+    unsigned int newlen = len + length;
+    if(!cstr) return false;
+    if(length == 0) return true;
+    if(!reserve(newlen)) return false;
+    memcpy(buffer + len, cstr, length);
+    len = newlen;
+    buffer[len] = 0;
+    return true;
+  }
+  bool concat(const String &s) { return concat(s.buffer, s.len); }
+  bool concat(const char *cstr) { return cstr ? concat(cstr, strlen(cstr)) : false; }
+  bool concat(char c) { char buf[2] = {c, 0}; return concat(buf, 1); }
+  bool concat(int n) { char buf[12]; return concat(buf, snprintf(buf, sizeof(buf), "%d", n)); }
+  bool concat(unsigned int n) { char buf[12]; return concat(buf, snprintf(buf, sizeof(buf), "%u", n)); }
+  bool concat(long n) { char buf[24]; return concat(buf, snprintf(buf, sizeof(buf), "%ld", n)); }
+  bool concat(unsigned long n) { char buf[24]; return concat(buf, snprintf(buf, sizeof(buf), "%lu", n)); }
+  bool concat(float n) { char buf[24]; return concat(buf, snprintf(buf, sizeof(buf), "%4.2f", n)); }
+
+  template <typename T> String &operator+=(T v) { concat(v); return *this; }
+  String &operator+=(const String &s) { concat(s); return *this; }
+  String &operator+=(unsigned char n) { concat((unsigned int)n); return *this; }
+  String &operator+=(short n) { concat((int)n); return *this; }
+  String &operator+=(unsigned short n) { concat((unsigned int)n); return *this; }
+  String &operator+=(double n) { concat((float)n); return *this; }
+
+  friend String operator+(const String &a, const String &b) { String s(a); s += b; return s; }
+  friend String operator+(const String &a, const char *b) { String s(a); s += b; return s; }
+
+  bool operator==(const String &rhs) const { return len == rhs.len && !strcmp(c_str(), rhs.c_str()); }
+  bool operator==(const char *cstr) const { return !strcmp(c_str(), cstr ? cstr : ""); }
+  bool operator!=(const String &rhs) const { return !(*this == rhs); }
+  char operator[](unsigned int i) const { return (i < len) ? buffer[i] : 0; }
+
+  unsigned int length(void) const { return len; }
+  const char *c_str() const { return buffer ? buffer : ""; }
+  char charAt(unsigned int i) const { return (*this)[i]; }
+  long toInt(void) const { return atol(c_str()); }
+  float toFloat(void) const { return atof(c_str()); }
+  void toCharArray(char *buf, unsigned int size, unsigned int index = 0) const
+  {
+    if(size == 0 || buf == NULL) return;
+    if(index >= len) { buf[0] = 0; return; }
+    unsigned int n = size - 1;
+    if(n > len - index) n = len - index;
+    memcpy(buf, buffer + index, n);
+    buf[n] = 0;
+  }
+
+private:
+  void init() { buffer = NULL; capacity = 0; len = 0; }
+  void invalidate() { hostFree(buffer); init(); }
+  bool changeBuffer(unsigned int maxStrLen)
+  {
+    size_t newSize = (maxStrLen + 16) & ~0xf;
+    char *newbuffer = (char *)hostRealloc(buffer, newSize);
+    if(newbuffer == NULL) return false;
+    size_t oldSize = capacity + 1;
+    if(newSize > oldSize) memset(newbuffer + oldSize, 0, newSize - oldSize);
+    capacity = newSize - 1;
+    buffer = newbuffer;
+    return true;
+  }
+  void copy(const char *cstr, unsigned int length)
+  {
+    if(!reserve(length)) { invalidate(); return; }
+    len = length;
+    memcpy(buffer, cstr, length);
+    buffer[len] = 0;
+  }
+  void move(String &rhs)
+  {
+    if(buffer)
+    {
+      if(rhs.buffer && capacity >= rhs.len)
+      {
+        memcpy(buffer, rhs.buffer, rhs.len + 1);
+        len = rhs.len;
+        rhs.len = 0;
+        return;
+      }
+      hostFree(buffer);
+    }
+    buffer = rhs.buffer;
+    capacity = rhs.capacity;
+    len = rhs.len;
+    rhs.init();
+  }
+  void num(const char *fmt, long value) { char buf[24]; snprintf(buf, sizeof(buf), fmt, value); *this = buf; }
+  void num(const char *fmt, unsigned long value) { char buf[24]; snprintf(buf, sizeof(buf), fmt, value); *this = buf; }
+  void num(const char *fmt, int value) { char buf[24]; snprintf(buf, sizeof(buf), fmt, value); *this = buf; }
+  void num(const char *fmt, unsigned int value) { char buf[24]; snprintf(buf, sizeof(buf), fmt, value); *this = buf; }
+  void dec(double value, unsigned char decimals) { char buf[33]; snprintf(buf, sizeof(buf), "%.*f", decimals, value); *this = buf; }
+
+  char *buffer;
+  unsigned int capacity;
+  unsigned int len;
+};
+
+#endif // ARDUINO_H
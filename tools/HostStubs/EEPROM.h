@@ -0,0 +1,23 @@
+/*
+  EEPROM.h - Host stand-in for the esp8266 EEPROM emulation, kept in RAM.
+  Copyright 2016 Greg Cunningham, CuriousTech.net
+*/
+#ifndef EEPROM_H
+#define EEPROM_H
+
+#include <Arduino.h>
+
+class EEPROMClass
+{
+public:
+  void    begin(size_t size) {}
+  uint8_t read(int addr) { return m_data[addr % sizeof(m_data)]; }
+  void    write(int addr, uint8_t val) { m_data[addr % sizeof(m_data)] = val; }
+  bool    commit() { return true; }
+
+private:
+  uint8_t m_data[4096] = {0};
+};
+inline EEPROMClass EEPROM;
+
+#endif // EEPROM_H
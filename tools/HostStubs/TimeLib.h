@@ -0,0 +1,91 @@
+/*
+  TimeLib.h - Host stand-in for the PJRC Time library (breakTime/makeTime and the clock).
+  Copyright 2016 Greg Cunningham, CuriousTech.net
+
+  Same field conventions: Year is offset from 1970, Month 1-12, Wday 1 = Sunday.
+  now() returns hostTime, which setTime() or the tool sets.
+*/
+#ifndef TIMELIB_H
+#define TIMELIB_H
+
+#include <stdint.h>
+#include <time.h>
+
+typedef enum { timeNotSet, timeNeedsSync, timeSet } timeStatus_t;
+
+typedef struct
+{
+  uint8_t Second;
+  uint8_t Minute;
+  uint8_t Hour;
+  uint8_t Wday;   // day of week, sunday is day 1
+  uint8_t Day;
+  uint8_t Month;
+  uint8_t Year;   // offset from 1970
+} tmElements_t;
+
+#define SECS_PER_DAY 86400UL
+#define LEAP_YEAR(Y) ( ((1970 + (Y)) > 0) && !((1970 + (Y)) % 4) && ( ((1970 + (Y)) % 100) || !((1970 + (Y)) % 400) ) )
+
+static const uint8_t monthDays[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+inline void breakTime(time_t timeInput, tmElements_t &tm)
+{
+  uint32_t time = (uint32_t)timeInput;
+  tm.Second = time % 60;
+  time /= 60;
+  tm.Minute = time % 60;
+  time /= 60;
+  tm.Hour = time % 24;
+  time /= 24; // days
+  tm.Wday = ((time + 4) % 7) + 1; // 1/1/1970 was a Thursday
+
+  uint8_t year = 0;
+  uint32_t days = 0;
+  while((unsigned)(days += (LEAP_YEAR(year) ? 366 : 365)) <= time)
+    year++;
+  tm.Year = year;
+  days -= LEAP_YEAR(year) ? 366 : 365;
+  time -= days; // day of year from 0
+
+  uint8_t month;
+  for(month = 0; month < 12; month++)
+  {
+    uint8_t len = (month == 1 && LEAP_YEAR(year)) ? 29 : monthDays[month];
+    if(time >= len)
+      time -= len;
+    else
+      break;
+  }
+  tm.Month = month + 1;
+  tm.Day = time + 1;
+}
+
+inline time_t makeTime(const tmElements_t &tm)
+{
+  uint32_t seconds = tm.Year * (SECS_PER_DAY * 365);
+  for(int i = 0; i < tm.Year; i++)
+    if(LEAP_YEAR(i))
+      seconds += SECS_PER_DAY;
+  for(int i = 1; i < tm.Month; i++)
+    seconds += SECS_PER_DAY * ((i == 2 && LEAP_YEAR(tm.Year)) ? 29 : monthDays[i - 1]);
+  seconds += (tm.Day - 1) * SECS_PER_DAY;
+  seconds += tm.Hour * 3600UL + tm.Minute * 60UL + tm.Second;
+  return (time_t)seconds;
+}
+
+inline time_t hostTime;
+inline time_t now() { return hostTime; }
+inline void setTime(time_t t) { hostTime = t; }
+inline timeStatus_t timeStatus() { return timeSet; }
+inline int hour() { return (uint32_t)now() / 3600 % 24; }
+inline int minute() { return (uint32_t)now() / 60 % 60; }
+inline int second() { return (uint32_t)now() % 60; }
+inline bool isPM() { return hour() >= 12; }
+inline int hourFormat12()
+{
+  int h = hour() % 12;
+  return h ? h : 12;
+}
+
+#endif // TIMELIB_H
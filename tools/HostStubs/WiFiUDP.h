@@ -0,0 +1,22 @@
+/*
+  WiFiUDP.h - Host stand-in so UdpTime builds.  Nothing is sent, parsePacket() never has data.
+  Copyright 2016 Greg Cunningham, CuriousTech.net
+*/
+#ifndef WIFIUDP_H
+#define WIFIUDP_H
+
+#include <Arduino.h>
+
+class WiFiUDP
+{
+public:
+  uint8_t begin(uint16_t port) { return 1; }
+  int     beginPacket(const char *host, uint16_t port) { return 1; }
+  size_t  write(const uint8_t *buf, size_t size) { return size; }
+  int     endPacket() { return 1; }
+  int     parsePacket() { return 0; }
+  int     read(uint8_t *buf, size_t len) { return 0; }
+  void    stop() {}
+};
+
+#endif // WIFIUDP_H
@@ -0,0 +1,723 @@
+/*
+  HostTests.cpp - Property tests and microbenchmarks for the firmware's core primitives.
+  Copyright 2016 Greg Cunningham, CuriousTech.net
+
+  Build: g++ -O2 -I../HostStubs -I../../Arduino -I../../libraries/UdpTime -o HostTests HostTests.cpp
+           ../../Arduino/eeMem.cpp ../../Arduino/HeapStat.cpp ../../Arduino/SensorTrace.cpp
+           ../../Arduino/Rules.cpp ../../libraries/UdpTime/UdpTime.cpp
+  Usage: HostTests [-n] [-s seed]
+
+  Checks, each against an independent oracle:
+    RunningMedian   median, lowest, highest and averages against a sorted copy of the window
+    jsonString      output parses as JSON and the values (escaped strings included) read back
+    Fletcher16      known vectors and a deferred-modulo reference; eeMem round trip
+    isDST, DST()    libc with the US rule (EST5EDT,M3.2.0,M11.1.0) every hour 1970-2100
+    sDec, timeFmt   printf for every value/second in range
+    SensorTrace     decoded download against the samples added, across the millis() wrap
+    Rules::compile  out of range values fail at their offset; source() compiles back to the same code
+  Then times each primitive: fixed iteration counts, best of 5 runs, so ns/op is comparable
+  between commits on the same machine.  -n skips the benchmarks.  Exits 1 on any failure.
+*/
+
+#include <Arduino.h>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "RunningMedian.h"
+#include "jsonstring.h"
+#include "eeMem.h"
+#include "UdpTime.h"
+#include "strfmt.h"
+#include "SensorTrace.h"
+#include "Rules.h"
+
+eeMem ee;
+
+static int failures;
+static uint32_t rndState = 1;
+static volatile uint32_t sink; // keeps benchmark results alive
+
+static uint32_t rnd(uint32_t n) // xorshift, repeatable for a seed
+{
+  rndState ^= rndState << 13;
+  rndState ^= rndState >> 17;
+  rndState ^= rndState << 5;
+  return rndState % n;
+}
+
+static void result(const char *pName, int fails, const char *pDetail)
+{
+  printf("%s %-14s %s\n", fails ? "FAIL" : "pass", pName, pDetail);
+  failures += fails;
+}
+
+template <typename F> static void bench(const char *pName, uint32_t iters, F f)
+{
+  double best = 1e30;
+
+  for(int run = 0; run < 5; run++)
+  {
+    auto start = std::chrono::steady_clock::now();
+    for(uint32_t i = 0; i < iters; i++)
+      f(i);
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iters;
+    if(ns < best)
+      best = ns;
+  }
+  printf("%-26s %9u %10.1f\n", pName, iters, best);
+}
+
+//
+// RunningMedian
+//
+static bool near(float a, double b)
+{
+  return fabs(a - b) <= 1e-3 * (fabs(b) + 1);
+}
+
+template <int N> static int checkMedian(int samples)
+{
+  RunningMedian<uint16_t, N> rm;
+  std::deque<uint16_t> window;
+  int fails = 0;
+
+  for(int i = 0; i < samples; i++)
+  {
+    uint16_t v = (rnd(8) == 0) ? rnd(65536) : 100 + rnd(50); // mostly close, some outliers
+    rm.add(v);
+    window.push_back(v);
+    if(window.size() > N)
+      window.pop_front();
+
+    std::vector<uint16_t> sorted(window.begin(), window.end());
+    std::sort(sorted.begin(), sorted.end());
+    size_t cnt = sorted.size();
+
+    uint16_t med = 0, lo = 0, hi = 0;
+    float av = 0;
+    if(rm.getMedian(med) != rm.OK || med != sorted[cnt / 2]) fails++;
+    if(rm.getLowest(lo) != rm.OK || lo != sorted[0]) fails++;
+    if(rm.getHighest(hi) != rm.OK || hi != sorted[cnt - 1]) fails++;
+    if(rm.getCount() != cnt) fails++;
+
+    double sum = 0;
+    for(uint16_t s : sorted) sum += s;
+    if(rm.getAverage(av) != rm.OK || !near(av, sum / cnt)) fails++;
+
+    for(uint8_t n = 1; n <= N; n++)
+    {
+      size_t m = std::min((size_t)n, cnt);
+      size_t start = (cnt - m) / 2;
+      double mid = 0;
+      for(size_t j = start; j < start + m; j++) mid += sorted[j];
+      if(rm.getAverage(n, av) != rm.OK || !near(av, mid / m)) fails++;
+    }
+  }
+  return fails;
+}
+
+static void testMedian()
+{
+  RunningMedian<uint16_t, 12> empty;
+  uint16_t v;
+  float av;
+  int fails = (empty.getMedian(v) != empty.NOK) + (empty.getAverage(2, av) != empty.NOK) + (empty.getAverage(0, av) != empty.NOK);
+
+  fails += checkMedian<4>(2000);
+  fails += checkMedian<8>(2000);
+  fails += checkMedian<12>(5000);
+  fails += checkMedian<20>(2000);
+  fails += checkMedian<32>(1000);
+  result("RunningMedian", fails, "windows 4-32, 12000 samples against a sorted window");
+}
+
+//
+// jsonString
+//
+struct jsonVal
+{
+  char type; // s n a o t f z
+  std::string s;
+  double n;
+  std::vector<jsonVal> a;
+  std::vector<std::pair<std::string, jsonVal> > o;
+};
+
+class jsonReader // strict enough to reject what a browser's JSON.parse would
+{
+public:
+  jsonReader(const char *p) : m_p(p) {}
+
+  bool parse(jsonVal &v)
+  {
+    if(!value(v))
+      return false;
+    ws();
+    return *m_p == 0;
+  }
+
+private:
+  void ws() { while(*m_p == ' ' || *m_p == '\t' || *m_p == '\r' || *m_p == '\n') m_p++; }
+
+  bool value(jsonVal &v)
+  {
+    ws();
+    if(*m_p == '"') { v.type = 's'; return str(v.s); }
+    if(*m_p == '[') return array(v);
+    if(*m_p == '{') return object(v);
+    if(!strncmp(m_p, "true", 4)) { v.type = 't'; m_p += 4; return true; }
+    if(!strncmp(m_p, "false", 5)) { v.type = 'f'; m_p += 5; return true; }
+    if(!strncmp(m_p, "null", 4)) { v.type = 'z'; m_p += 4; return true; }
+    return num(v);
+  }
+
+  bool num(jsonVal &v)
+  {
+    const char *start = m_p;
+    if(*m_p == '-') m_p++;
+    if(!isdigit((uint8_t)*m_p)) return false;
+    if(*m_p == '0' && isdigit((uint8_t)m_p[1])) return false; // no leading zeros
+    while(isdigit((uint8_t)*m_p)) m_p++;
+    if(*m_p == '.')
+    {
+      m_p++;
+      if(!isdigit((uint8_t)*m_p)) return false;
+      while(isdigit((uint8_t)*m_p)) m_p++;
+    }
+    if(*m_p == 'e' || *m_p == 'E')
+    {
+      m_p++;
+      if(*m_p == '+' || *m_p == '-') m_p++;
+      if(!isdigit((uint8_t)*m_p)) return false;
+      while(isdigit((uint8_t)*m_p)) m_p++;
+    }
+    v.type = 'n';
+    v.n = strtod(start, NULL);
+    return true;
+  }
+
+  bool str(std::string &s)
+  {
+    m_p++; // "
+    for(;;)
+    {
+      uint8_t c = *m_p++;
+      if(c == '"') return true;
+      if(c < ' ') return false; // unescaped control char (or end)
+      if(c != '\\') { s += c; continue; }
+      switch(*m_p++)
+      {
+        case '"': s += '"'; break;
+        case '\\': s += '\\'; break;
+        case '/': s += '/'; break;
+        case 'b': s += '\b'; break;
+        case 'f': s += '\f'; break;
+        case 'n': s += '\n'; break;
+        case 'r': s += '\r'; break;
+        case 't': s += '\t'; break;
+        case 'u':
+        {
+          unsigned u = 0;
+          for(int i = 0; i < 4; i++)
+          {
+            if(!isxdigit((uint8_t)*m_p)) return false;
+            char h[2] = {*m_p++, 0};
+            u = u << 4 | strtoul(h, NULL, 16);
+          }
+          if(u > 0x7F) return false; // only ASCII is ever escaped
+          s += (char)u;
+          break;
+        }
+        default: return false;
+      }
+    }
+  }
+
+  bool array(jsonVal &v)
+  {
+    v.type = 'a';
+    m_p++;
+    ws();
+    if(*m_p == ']') { m_p++; return true; }
+    for(;;)
+    {
+      jsonVal e;
+      if(!value(e)) return false;
+      v.a.push_back(e);
+      ws();
+      if(*m_p == ']') { m_p++; return true; }
+      if(*m_p++ != ',') return false;
+    }
+  }
+
+  bool object(jsonVal &v)
+  {
+    v.type = 'o';
+    m_p++;
+    ws();
+    if(*m_p == '}') { m_p++; return true; }
+    for(;;)
+    {
+      std::string key;
+      jsonVal e;
+      ws();
+      if(*m_p != '"' || !str(key)) return false;
+      ws();
+      if(*m_p++ != ':') return false;
+      if(!value(e)) return false;
+      v.o.push_back( {key, e} );
+      ws();
+      if(*m_p == '}') { m_p++; return true; }
+      if(*m_p++ != ',') return false;
+    }
+  }
+
+  const char *m_p;
+};
+
+static const jsonVal *member(const jsonVal &obj, const char *pKey)
+{
+  for(auto &m : obj.o)
+    if(m.first == pKey)
+      return &m.second;
+  return NULL;
+}
+
+static std::string randomText(int maxLen) // ASCII with quotes, backslashes and control chars
+{
+  static const char special[] = "\"\\\n\r\t\b\f\x01\x1f/";
+  std::string s;
+  int len = rnd(maxLen + 1);
+  for(int i = 0; i < len; i++)
+    s += (rnd(4) == 0) ? special[rnd(sizeof(special) - 1)] : (char)(1 + rnd(127));
+  return s;
+}
+
+static bool checkJson(const std::string &a, const std::string &b, const String &sArr0, int iv, uint32_t uv, long lv, float fv, bool bv)
+{
+  uint16_t arr16[3] = {0, 1, (uint16_t)uv};
+  uint32_t arr32[2] = {uv, 0xFFFFFFFF};
+  String arrS[2] = {sArr0, String(a.c_str())};
+
+  jsonString js("test");
+  js.Var("i", iv);
+  js.Var("u", uv);
+  js.Var("l", lv);
+  js.Var("f", fv);
+  js.Var("b", bv);
+  js.Var("cs", a.c_str());
+  js.Var("S", String(b.c_str()));
+  js.Array("as", arrS, 2);
+  js.Array("a16", arr16, 3);
+  js.Array("a32", arr32, 2);
+  String out = js.Close();
+
+  jsonVal v;
+  jsonReader rd(out.c_str());
+  if(!rd.parse(v) || v.type != 'o')
+  {
+    printf("  unparsable: %s\n", out.c_str());
+    return false;
+  }
+  const jsonVal *p;
+  bool bOk = (p = member(v, "cmd")) && p->s == "test";
+  bOk &= (p = member(v, "i")) && p->type == 'n' && p->n == iv;
+  bOk &= (p = member(v, "u")) && p->type == 'n' && p->n == uv;
+  bOk &= (p = member(v, "l")) && p->type == 'n' && p->n == lv;
+  bOk &= (p = member(v, "f")) && p->type == 'n' && fabs(p->n - fv) <= 0.005001 * (fabs(fv) + 1);
+  bOk &= (p = member(v, "b")) && p->type == 'n' && p->n == (bv ? 1 : 0);
+  bOk &= (p = member(v, "cs")) && p->type == 's' && p->s == a;
+  bOk &= (p = member(v, "S")) && p->type == 's' && p->s == b;
+  bOk &= (p = member(v, "as")) && p->a.size() == 2 && p->a[0].s == sArr0.c_str() && p->a[1].s == a;
+  bOk &= (p = member(v, "a16")) && p->a.size() == 3 && p->a[2].n == (uint16_t)uv;
+  bOk &= (p = member(v, "a32")) && p->a.size() == 2 && p->a[0].n == uv && p->a[1].n == 0xFFFFFFFF;
+  if(!bOk)
+    printf("  values differ: %s\n", out.c_str());
+  return bOk;
+}
+
+static void testJson()
+{
+  int fails = 0;
+  const char *fixed[] = { "", "\"", "\\", "a\"b\\c", "\x01\x1f", "line\r\nbreak", "pass\"word" };
+
+  for(const char *p : fixed)
+    fails += !checkJson(p, p, String(p), 0, 0, 0, 0, false);
+  for(int i = 0; i < 20000; i++)
+  {
+    int iv = (int)(rnd(0xFFFFFFFF) - 0x7FFFFFFF);
+    uint32_t uv = rnd(0xFFFFFFFF);
+    float fv = ((int)rnd(2000000) - 1000000) / 100.0f;
+    fails += !checkJson(randomText(40), randomText(40), String(randomText(8).c_str()), iv, uv, (long)iv * 3, fv, rnd(2));
+  }
+  result("jsonString", fails, "20007 messages parse and read back, escapes included");
+}
+
+//
+// Fletcher16
+//
+static uint16_t fletcherRef(const uint8_t *p, size_t len) // deferred modulo, as in RFC 1146 notes
+{
+  uint32_t c0 = 0, c1 = 0;
+
+  while(len)
+  {
+    size_t block = std::min(len, (size_t)5802); // sums can't overflow 32 bits within a block
+    len -= block;
+    for(size_t i = 0; i < block; i++)
+    {
+      c0 += *p++;
+      c1 += c0;
+    }
+    c0 %= 255;
+    c1 %= 255;
+  }
+  return c1 << 8 | c0;
+}
+
+static void testFletcher()
+{
+  int fails = 0;
+  struct { const char *p; uint16_t sum; } vec[] = { {"abcde", 0xC8F0}, {"abcdef", 0x2057}, {"abcdefgh", 0x0627} };
+
+  for(auto &v : vec)
+    fails += eeMem::Fletcher16((uint8_t *)v.p, strlen(v.p)) != v.sum;
+
+  std::vector<uint8_t> buf(9000);
+  for(int i = 0; i < 2000; i++)
+  {
+    size_t len = rnd(buf.size() + 1);
+    for(size_t j = 0; j < len; j++)
+      buf[j] = (i & 1) ? 0xFF : rnd(256); // all 0xFF is the worst case for the sums
+    fails += eeMem::Fletcher16(&buf[0], len) != fletcherRef(&buf[0], len);
+  }
+
+  ee.tz = -7; // round trip through EEPROM
+  ee.rules[0] = 0x12;
+  ee.update();
+  eeMem e2;
+  fails += (e2.tz != -7 || e2.rules[0] != 0x12 || e2.sum != ee.sum);
+
+  result("Fletcher16", fails, "3 vectors, 2000 buffers to 9000 bytes, eeMem round trip");
+}
+
+//
+// isDST
+//
+static void testDST()
+{
+  setenv("TZ", "EST5EDT,M3.2.0,M11.1.0", 1); // today's US rule applied to every year, as isDST does
+  tzset();
+
+  int fails = 0;
+  uint32_t end = 4133980800UL; // 2101-01-01
+  for(uint32_t t = 0; t < end; t += 3600)
+  {
+    time_t utc = (time_t)t + 5 * 3600; // t is local standard time
+    struct tm tm;
+    localtime_r(&utc, &tm);
+    if(UdpTime::isDST(t) != (tm.tm_isdst > 0))
+    {
+      if(fails++ < 4)
+      {
+        tmElements_t te;
+        breakTime(t, te);
+        printf("  %04d-%02d-%02d %02d:00 standard: isDST %d, libc %d\n", te.Year + 1970, te.Month, te.Day, te.Hour,
+          UdpTime::isDST(t), tm.tm_isdst);
+      }
+    }
+  }
+  result("isDST", fails, "every hour 1970-2100 against libc");
+
+  static UdpTime ut; // zeroed like the firmware global; DST() reads the clock, which includes the current offset
+  fails = 0;
+  for(uint32_t t = 0; t < end; t += 3600)
+  {
+    setTime(t + ut.getDST() * 3600);
+    ut.DST();
+    time_t utc = (time_t)t + 5 * 3600;
+    struct tm tm;
+    localtime_r(&utc, &tm);
+    fails += ut.getDST() != (tm.tm_isdst > 0);
+  }
+  result("UdpTime::DST", fails, "clock stepped every hour 1970-2100, against libc");
+}
+
+//
+// sDec, timeFmt
+//
+static void testFmt()
+{
+  int fails = 0;
+  char buf[40];
+
+  for(int t = -100000; t <= 100000; t++)
+  {
+    snprintf(buf, sizeof(buf), "%.1f", t / 10.0);
+    fails += !(sDec(t) == buf);
+  }
+
+  for(uint32_t t = 0; t < 86400; t++)
+  {
+    setTime(1500000000 - 1500000000 % 86400 + t);
+    int h = t / 3600 % 12;
+    if(h == 0) h = 12;
+    const char *pM = (t >= 43200) ? "PM" : "AM";
+
+    snprintf(buf, sizeof(buf), "%2d:%02d:%02d %s", h, t / 60 % 60, t % 60, pM);
+    fails += !(timeFmt(true, true) == buf);
+    snprintf(buf, sizeof(buf), "%2d:%02d%s", h, t / 60 % 60, pM);
+    fails += !(timeFmt(false, true) == buf);
+    snprintf(buf, sizeof(buf), "%2d:%02d:%02d ", h, t / 60 % 60, t % 60);
+    fails += !(timeFmt(true, false) == buf);
+    snprintf(buf, sizeof(buf), "%2d:%02d", h, t / 60 % 60);
+    fails += !(timeFmt(false, false) == buf);
+  }
+  result("sDec/timeFmt", fails, "-10000.0 to 10000.0, every second of a day in 4 formats");
+}
+
+//
+// SensorTrace
+//
+struct traceIn { uint32_t ms; uint8_t ch; int16_t val; };
+
+static int checkTrace(uint32_t startMs, int samples)
+{
+  static SensorTrace tr; // 8K, keep it off the stack
+  std::vector<traceIn> in;
+  int fails = 0;
+
+  tr.clear();
+  uint32_t ms = startMs;
+  for(int i = 0; i < samples; i++)
+  {
+    uint32_t r = rnd(100);
+    if(r < 5)
+      ms -= rnd(50);         // late edge time, older than the last record
+    else if(r < 10)
+      ms += 1000 + rnd(300000); // idle gap, varint dt
+    else
+      ms += rnd(120);
+    traceIn s = { ms, (uint8_t)rnd(TR_CHANNELS), (int16_t)(rnd(8) ? 200 + rnd(100) : rnd(65536)) };
+    tr.add(s.ch, s.val, s.ms);
+    in.push_back(s);
+  }
+
+  std::vector<uint8_t> buf(tr.size());
+  for(size_t n = 0; n < buf.size(); ) // in pieces, as the web server asks
+    n += tr.read(&buf[n], std::min((size_t)1460, buf.size() - n), n);
+
+  uint32_t t = buf[4] | buf[5] << 8 | buf[6] << 16 | (uint32_t)buf[7] << 24;
+  int16_t last[TR_CHANNELS];
+  for(int ch = 0; ch < TR_CHANNELS; ch++)
+    last[ch] = buf[8 + ch * 2] | buf[9 + ch * 2] << 8;
+
+  std::vector<traceIn> out;
+  for(size_t pos = TRACE_HDR; pos < buf.size(); )
+  {
+    uint8_t tag = buf[pos++];
+    uint32_t dt = tag & 31, zz = 0;
+    if(dt == 31)
+      for(uint8_t sh = dt = 0; pos < buf.size(); sh += 7)
+      {
+        dt |= (uint32_t)(buf[pos] & 0x7F) << sh;
+        if((buf[pos++] & 0x80) == 0) break;
+      }
+    for(uint8_t sh = 0; pos < buf.size(); sh += 7)
+    {
+      zz |= (uint32_t)(buf[pos] & 0x7F) << sh;
+      if((buf[pos++] & 0x80) == 0) break;
+    }
+    t += dt * 10;
+    last[tag >> 5] += (int16_t)((zz >> 1) ^ -(zz & 1));
+    out.push_back( {t, (uint8_t)(tag >> 5), last[tag >> 5]} );
+  }
+
+  if(out.size() > in.size() || out.size() < 100)
+    return 1;
+  size_t skip = in.size() - out.size(); // evicted
+  uint32_t newest = in[skip].ms;        // newest time recorded so far
+  for(size_t i = 0; i < skip; i++)
+    if((int32_t)(in[i].ms - newest) > 0)
+      newest = in[i].ms;
+  for(size_t i = 0; i < out.size(); i++)
+  {
+    const traceIn &a = in[skip + i], &b = out[i];
+    if((int32_t)(a.ms - newest) > 0)
+      newest = a.ms;
+    int32_t err = (int32_t)(newest - b.ms); // older samples are recorded at the newest time
+    if(a.ch != b.ch || a.val != b.val || err < 0 || err >= 10)
+      if(fails++ < 4)
+        printf("  start %08x record %zu: ch %d/%d val %d/%d ms %08x/%08x\n", startMs, i, a.ch, b.ch, a.val, b.val, a.ms, b.ms);
+  }
+  return fails;
+}
+
+static void testTrace()
+{
+  int fails = 0;
+
+  fails += checkTrace(0, 2000);
+  fails += checkTrace(0xFFFFFFFF - 20000, 2000); // wraps in the middle, nothing evicted
+  fails += checkTrace(0xFFFFFFFF - 500000, 20000); // wraps, oldest records evicted into the base
+  for(int i = 0; i < 20; i++)
+    fails += checkTrace(rnd(0xFFFFFFFF), 500 + rnd(10000));
+  result("SensorTrace", fails, "23 traces, 2 across the millis() wrap, with eviction and late samples");
+}
+
+//
+// Rules::compile
+//
+static void rulesCallback(uint8_t action, const char *pText) {}
+
+static void testRules()
+{
+  static Rules rules(rulesCallback);
+  uint8_t code[RULES_SIZE], code2[RULES_SIZE];
+  int fails = 0;
+
+  struct { const char *p; int err; } vec[] = { // err: offset of the bad value, -1 compiles
+    {"door=1 & time>=22:00 : close; temp<35 : push Garage is cold", -1},
+    {"temp<-100.0 : close; rh>=100 : alert wet; time<23:59 & hour>=0 & min=59 : open", -1},
+    {"temp<4000 : close", 5},       // 40000 tenths would wrap int16
+    {"temp<99999999999 : open", 5},
+    {"temp<-100.1 : close", 5},
+    {"rh>100.1 : close", 3},
+    {"rh>-1 : close", 3},
+    {"door=2 : close", 5},
+    {"hour=24 : close", 5},
+    {"min<60 : close", 4},
+    {"time>=25:00 : close", 6},
+    {"time>=22:99 : close", 6},
+    {"time>=2299 : close", 6},
+    {"door=1 & time>=22:100 : close", 15},
+  };
+  for(auto &v : vec)
+  {
+    int n = rules.compile(v.p, code, sizeof(code));
+    if(v.err < 0 ? n <= 0 : n != -v.err - 1)
+    {
+      if(fails++ < 4)
+        printf("  \"%s\": %d\n", v.p, n);
+      continue;
+    }
+    if(n > 0 && (rules.compile(rules.source(code).c_str(), code2, sizeof(code2)) != n || memcmp(code, code2, n)) )
+      fails++;
+  }
+
+  static const char *names[] = { "door", "car", "motion", "temp", "rh", "hour", "min", "time" };
+  static const int lo[] = { 0, 0, 0, -1000, 0, 0, 0, 0 }, hi[] = { 1, 1, 1, 2000, 1000, 23, 59, 2359 };
+  for(int i = 0; i < 5000; i++) // one condition, in range or just out of it
+  {
+    int var = rnd(8);
+    int val = (var == 7) ? rnd(24) * 100 + rnd(60) : lo[var] + rnd(hi[var] - lo[var] + 1);
+    bool bBad = rnd(4) == 0;
+    if(bBad && var == 7) // hour or minutes past the end
+      val = rnd(2) ? (24 + rnd(10)) * 100 + rnd(60) : rnd(24) * 100 + 60 + rnd(40);
+    else if(bBad)
+      val = rnd(2) ? lo[var] - 1 - rnd(50) : hi[var] + 1 + rnd(50);
+    char buf[40];
+    int len = snprintf(buf, sizeof(buf), "%s>=", names[var]);
+    if(var == 3 || var == 4)
+      snprintf(buf + len, sizeof(buf) - len, "%s%d.%d : open", val < 0 ? "-" : "", abs(val) / 10, abs(val) % 10);
+    else if(var == 7)
+      snprintf(buf + len, sizeof(buf) - len, "%d:%02d : open", val / 100, val % 100);
+    else
+      snprintf(buf + len, sizeof(buf) - len, "%d : open", val);
+    int n = rules.compile(buf, code, sizeof(code));
+    if(bBad ? n != -len - 1 : (n != 5 || (int16_t)(code[2] | code[3] << 8) != val) )
+      if(fails++ < 4)
+        printf("  \"%s\": %d\n", buf, n);
+  }
+  result("Rules::compile", fails, "14 vectors with source() round trip, 5000 values at and past each range");
+}
+
+static void benchmarks()
+{
+  printf("\nbenchmark                      iters      ns/op  (best of 5)\n");
+
+  RunningMedian<uint16_t, 12> rm;
+  bench("RunningMedian<12> add+avg", 200000, [&](uint32_t i) {
+    float av;
+    rm.add(100 + (i * 7919) % 50);
+    rm.getAverage(2, av);
+    sink += av;
+  });
+  bench("RunningMedian<12> median", 200000, [&](uint32_t i) {
+    uint16_t v;
+    rm.add(100 + (i * 7919) % 50);
+    rm.getMedian(v);
+    sink += v;
+  });
+
+  bench("jsonString state message", 100000, [&](uint32_t i) {
+    jsonString js("state");
+    js.Var("t", (uint32_t)1500000000 + i);
+    js.Var("door", (bool)(i & 1));
+    js.Var("car", (bool)(i & 2));
+    js.Var("temp", sDec(685 + i % 10));
+    js.Var("rh", sDec(452));
+    js.Var("o", true);
+    js.Var("carVal", (int)(i % 400));
+    js.Var("doorVal", (int)(i % 300));
+    js.Var("motion", false);
+    sink += js.Close().length();
+  });
+  bench("jsonString escaped 64B", 100000, [&](uint32_t i) {
+    jsonString js;
+    js.Var("body", "Door \"not\" closed\\\r\n\tat the garage, check the \"remote\" \x01");
+    sink += js.Close().length();
+  });
+
+  uint8_t eeData[EESIZE];
+  memcpy(eeData, (uint8_t *)&ee + offsetof(eeMem, size), EESIZE);
+  bench("Fletcher16 eeMem", 100000, [&](uint32_t i) {
+    eeData[5] = i;
+    sink += eeMem::Fletcher16(eeData, EESIZE);
+  });
+
+  bench("isDST", 1000000, [&](uint32_t i) {
+    sink += UdpTime::isDST(1500000000 + i * 3607);
+  });
+
+  bench("sDec", 1000000, [&](uint32_t i) {
+    sink += sDec((int)(i % 2000) - 1000).length();
+  });
+  bench("timeFmt(true, true)", 1000000, [&](uint32_t i) {
+    setTime(1500000000 + i);
+    sink += timeFmt(true, true).length();
+  });
+}
+
+int main(int argc, char **argv)
+{
+  bool bBench = true;
+
+  for(int i = 1; i < argc; i++)
+  {
+    if(!strcmp(argv[i], "-n"))
+      bBench = false;
+    else if(!strcmp(argv[i], "-s") && i + 1 < argc)
+      rndState = strtoul(argv[++i], NULL, 0) | 1;
+    else
+    {
+      fprintf(stderr, "Usage: HostTests [-n] [-s seed]\n");
+      return 1;
+    }
+  }
+
+  testMedian();
+  testJson();
+  testFletcher();
+  testDST();
+  testFmt();
+  testTrace();
+  testRules();
+  if(bBench)
+    benchmarks();
+
+  printf("\n%s\n", failures ? "FAILED" : "all passed");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,481 @@
+/*
+  OtaUpload.cpp - Resumable, optionally gzipped firmware upload to the /update endpoint.
+  Copyright 2016 Greg Cunningham, CuriousTech.net
+
+  Build: g++ -O2 -o OtaUpload OtaUpload.cpp -lz -lcrypto
+  Usage: OtaUpload [-z] [-c chunkKB] -k password host[:port] firmware.bin
+         OtaUpload -s [-c chunkKB] [-r linkKB/s] [-f flashKB/s] [-d drop%] firmware.bin
+
+  The image is sent in chunks, each a POST carrying its offset.  A dropped chunk is resent from
+  the offset the device reports, so a weak link only costs the failed chunk.  -z gzips the
+  image first (the device's core must be 2.7.0+ to boot gzip images).  Prints sizes, time and
+  throughput, with the time an uncompressed upload would take at the same rate for comparison.
+
+  -s uploads to a simulated device instead: the same client loop posts to a model of /update
+  with a fixed link rate, flash write rate and drop rate (seeded, so runs are repeatable).
+  Both the raw and gzipped image are sent, the simulated flash is checked against the image
+  (inflated for gzip, as the bootloader would), and the size and time of each are reported.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <zlib.h>
+#include <openssl/evp.h>
+
+static double nowSec()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static std::string urlEncode(const char *p)
+{
+  std::string s;
+  char hex[4];
+
+  for(; *p; p++)
+  {
+    if(isalnum((unsigned char)*p) || strchr("-_.~", *p))
+      s += *p;
+    else
+    {
+      snprintf(hex, sizeof(hex), "%%%02X", (unsigned char)*p);
+      s += hex;
+    }
+  }
+  return s;
+}
+
+static bool gzip(const std::vector<uint8_t> &in, std::vector<uint8_t> &out)
+{
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  if(deflateInit2(&zs, 9, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) // 16 = gzip header
+    return false;
+  out.resize(deflateBound(&zs, in.size()));
+  zs.next_in = (Bytef *)&in[0];
+  zs.avail_in = in.size();
+  zs.next_out = &out[0];
+  zs.avail_out = out.size();
+  int ret = deflate(&zs, Z_FINISH);
+  out.resize(zs.total_out);
+  deflateEnd(&zs);
+  return ret == Z_STREAM_END;
+}
+
+static std::string md5Hex(const std::vector<uint8_t> &data)
+{
+  unsigned char md[EVP_MAX_MD_SIZE];
+  unsigned int len = 0;
+  char hex[3];
+  std::string s;
+
+  EVP_Digest(&data[0], data.size(), md, &len, EVP_md5(), NULL);
+  for(unsigned int i = 0; i < len; i++)
+  {
+    snprintf(hex, sizeof(hex), "%02x", md[i]);
+    s += hex;
+  }
+  return s;
+}
+
+// One HTTP request with Connection: close.  Returns the status, or -1 on a network error
+static int httpRequest(const char *pHost, const char *pPort, const std::string &head, const uint8_t *pBody, size_t len, std::string &reply)
+{
+  struct addrinfo hints, *res;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if(getaddrinfo(pHost, pPort, &hints, &res))
+    return -1;
+
+  int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  if(fd < 0 || connect(fd, res->ai_addr, res->ai_addrlen))
+  {
+    if(fd >= 0) close(fd);
+    freeaddrinfo(res);
+    return -1;
+  }
+  freeaddrinfo(res);
+
+  struct timeval tv = {10, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+  bool bOk = (send(fd, head.c_str(), head.size(), MSG_NOSIGNAL) == (ssize_t)head.size());
+  for(size_t sent = 0; bOk && sent < len; )
+  {
+    ssize_t n = send(fd, pBody + sent, len - sent, MSG_NOSIGNAL);
+    if(n <= 0)
+      bOk = false;
+    else
+      sent += n;
+  }
+
+  reply.clear();
+  char buf[1024];
+  ssize_t n;
+  while(bOk && (n = recv(fd, buf, sizeof(buf), 0)) > 0)
+    reply.append(buf, n);
+  close(fd);
+
+  int status;
+  if(!bOk || sscanf(reply.c_str(), "HTTP/%*s %d", &status) != 1)
+    return -1;
+  return status;
+}
+
+// Simulated device: same replies as otaBody()/otaReply() in GarageDoor.ino
+struct mockDevice
+{
+  double  linkRate = 40 * 1024;   // bytes/s
+  double  flashRate = 90 * 1024;  // bytes/s, erase + write
+  double  reqTime = 0.03;         // connect and reply per request, s
+  int     dropPct = 0;
+  double  clock = 0;              // simulated s
+  std::vector<uint8_t> flash;
+  size_t  size = 0;
+  std::string md5;
+  bool    bDone = false;
+};
+
+static bool bMock;
+static mockDevice mock;
+
+static std::string queryVal(const std::string &head, const char *pKey)
+{
+  std::string k = std::string(pKey) + "=";
+  size_t pos = head.find("?" + k);
+  if(pos == std::string::npos)
+    pos = head.find("&" + k);
+  if(pos == std::string::npos)
+    return "";
+  pos += k.size() + 1;
+  return head.substr(pos, head.find_first_of("& ", pos) - pos);
+}
+
+static int mockRequest(const std::string &head, const uint8_t *pBody, size_t len, std::string &reply)
+{
+  int status = 200;
+  mock.clock += mock.reqTime;
+
+  if(head.compare(0, 4, "POST") == 0)
+  {
+    size_t offset = atol(queryVal(head, "offset").c_str());
+    if(offset == 0) // new image
+    {
+      mock.flash.clear();
+      mock.size = atol(queryVal(head, "size").c_str());
+      mock.md5 = queryVal(head, "md5");
+      mock.bDone = false;
+      if(mock.md5.size() != 32)
+        status = 410;
+    }
+    else if(offset > mock.flash.size())
+      status = 409;
+
+    if(status == 200)
+    {
+      size_t got = len;
+      if(rand() % 100 < mock.dropPct) // link drops part way through the body
+        got = rand() % len;
+      size_t skip = std::min(mock.flash.size() - offset, got);
+      mock.flash.insert(mock.flash.end(), pBody + skip, pBody + got);
+      mock.clock += got / mock.linkRate + (got - skip) / mock.flashRate;
+      if(got < len)
+        return -1;
+      if(mock.flash.size() == mock.size)
+      {
+        if(md5Hex(mock.flash) == mock.md5)
+          mock.bDone = true;
+        else
+          status = 500;
+      }
+    }
+  }
+  reply = "HTTP/1.1 " + std::to_string(status) + " OK\r\n\r\n{\"offset\":" + std::to_string(mock.flash.size())
+    + ",\"size\":" + std::to_string(mock.size) + ",\"done\":" + (mock.bDone ? "true" : "false") + "}";
+  return status;
+}
+
+static int request(const std::string &host, const std::string &port, const std::string &head, const uint8_t *pBody, size_t len, std::string &reply)
+{
+  if(bMock)
+    return mockRequest(head, pBody, len, reply);
+  return httpRequest(host.c_str(), port.c_str(), head, pBody, len, reply);
+}
+
+static double now()
+{
+  return bMock ? mock.clock : nowSec();
+}
+
+static void retryWait()
+{
+  if(bMock)
+    mock.clock += 1;
+  else
+    sleep(1);
+}
+
+static bool gunzip(const std::vector<uint8_t> &in, std::vector<uint8_t> &out)
+{
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  if(inflateInit2(&zs, 15 + 16) != Z_OK)
+    return false;
+  zs.next_in = (Bytef *)&in[0];
+  zs.avail_in = in.size();
+  uint8_t buf[4096];
+  int ret;
+  out.clear();
+  do
+  {
+    zs.next_out = buf;
+    zs.avail_out = sizeof(buf);
+    ret = inflate(&zs, Z_NO_FLUSH);
+    out.insert(out.end(), buf, buf + sizeof(buf) - zs.avail_out);
+  } while(ret == Z_OK);
+  inflateEnd(&zs);
+  return ret == Z_STREAM_END;
+}
+
+static long jsonNum(const std::string &s, const char *pKey)
+{
+  std::string k = std::string("\"") + pKey + "\":";
+  size_t pos = s.find(k);
+  return (pos == std::string::npos) ? -1 : atol(s.c_str() + pos + k.size());
+}
+
+struct uploadStats
+{
+  double secs;
+  size_t wire;   // bytes sent, including resends
+  int    retries;
+};
+
+static bool upload(const std::string &host, const std::string &port, const std::string &query,
+  const std::vector<uint8_t> &image, size_t chunk, bool bProgress, uploadStats &st)
+{
+  double start = now();
+  size_t offset = 0;
+  size_t goodOffset = 0; // furthest the device has confirmed
+  int    fails = 0;      // failures since the offset last moved
+  std::string reply;
+
+  st.wire = 0;
+  st.retries = 0;
+  while(offset < image.size())
+  {
+    size_t len = std::min(chunk, image.size() - offset);
+    std::string head = "POST " + query + "&offset=" + std::to_string(offset) + " HTTP/1.1\r\n"
+      "Host: " + host + "\r\n"
+      "Content-Type: application/octet-stream\r\n"
+      "Content-Length: " + std::to_string(len) + "\r\n"
+      "Connection: close\r\n\r\n";
+
+    int status = request(host, port, head, &image[offset], len, reply);
+    st.wire += len;
+    long devOffset = jsonNum(reply, "offset");
+
+    if(status == 200 || status == 409) // 409: device wants a different offset
+    {
+      if(devOffset < 0)
+      {
+        fprintf(stderr, "bad reply\n");
+        return false;
+      }
+      offset = devOffset;
+      if(offset > goodOffset)
+      {
+        goodOffset = offset;
+        fails = 0;
+      }
+      if(bProgress)
+      {
+        printf("\r%zu / %zu", offset, image.size());
+        fflush(stdout);
+      }
+      continue;
+    }
+    if(status > 0) // rejected
+    {
+      fprintf(stderr, "\nHTTP %d: %s\n", status, reply.c_str());
+      return false;
+    }
+
+    st.retries++;
+    if(++fails > 20)
+    {
+      fprintf(stderr, "\nno progress after %d tries, giving up\n", fails - 1);
+      return false;
+    }
+    if(bProgress)
+      fprintf(stderr, "\nchunk at %zu failed, resuming\n", offset);
+    retryWait();
+    head = "GET /update HTTP/1.1\r\nHost: " + host + "\r\nConnection: close\r\n\r\n";
+    if(request(host, port, head, NULL, 0, reply) == 200 && (devOffset = jsonNum(reply, "offset")) >= 0)
+      offset = devOffset;
+    if(offset > goodOffset) // the failed chunk partly landed
+    {
+      goodOffset = offset;
+      fails = 0;
+    }
+  }
+  st.secs = now() - start;
+  return true;
+}
+
+// -s: raw and gzipped image through the simulated device
+static int simulate(const std::vector<uint8_t> &raw, size_t chunk)
+{
+  std::vector<uint8_t> gz, check;
+  if(!gzip(raw, gz))
+  {
+    fprintf(stderr, "gzip failed\n");
+    return 1;
+  }
+  printf("simulated link %.0f KB/s, flash %.0f KB/s, %d%% drops, %zu KB chunks\n",
+    mock.linkRate / 1024, mock.flashRate / 1024, mock.dropPct, chunk / 1024);
+
+  uploadStats st[2];
+  const std::vector<uint8_t> *pImage[2] = {&raw, &gz};
+  const char *pName[2] = {"raw", "gzip"};
+
+  for(int i = 0; i < 2; i++)
+  {
+    const std::vector<uint8_t> &image = *pImage[i];
+    std::string query = "/update?key=sim&size=" + std::to_string(image.size()) + "&md5=" + md5Hex(image);
+
+    srand(1); // same drops for both
+    mock.clock = 0;
+    if(!upload("sim", "80", query, image, chunk, false, st[i]))
+      return 1;
+    bool bGood = mock.bDone && mock.flash == image;
+    if(i == 1)
+      bGood = bGood && gunzip(mock.flash, check) && check == raw;
+    if(!bGood)
+    {
+      fprintf(stderr, "%s: simulated flash does not match the image\n", pName[i]);
+      return 1;
+    }
+    printf("%-4s %8zu bytes  %6.1f s  %8zu on the wire (%2.0f%% resent)  %2d retries", pName[i], image.size(),
+      st[i].secs, st[i].wire, 100.0 * (st[i].wire - image.size()) / image.size(), st[i].retries);
+    if(i == 1)
+      printf("  %.0f%% of raw size, %.0f%% of raw time", 100.0 * gz.size() / raw.size(), 100.0 * st[1].secs / st[0].secs);
+    printf("\n");
+  }
+  return 0;
+}
+
+static void usage()
+{
+  fprintf(stderr, "Usage: OtaUpload [-z] [-c chunkKB] -k password host[:port] firmware.bin\n"
+                  "       OtaUpload -s [-c chunkKB] [-r linkKB/s] [-f flashKB/s] [-d drop%%] firmware.bin\n");
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  bool bGzip = false;
+  size_t chunk = 16 * 1024;
+  const char *pKey = NULL;
+  const char *pArgs[2] = {NULL, NULL};
+  int nArgs = 0;
+
+  for(int i = 1; i < argc; i++)
+  {
+    if(!strcmp(argv[i], "-z"))
+      bGzip = true;
+    else if(!strcmp(argv[i], "-c") && i + 1 < argc)
+      chunk = atoi(argv[++i]) * 1024;
+    else if(!strcmp(argv[i], "-k") && i + 1 < argc)
+      pKey = argv[++i];
+    else if(!strcmp(argv[i], "-s"))
+      bMock = true;
+    else if(!strcmp(argv[i], "-r") && i + 1 < argc)
+      mock.linkRate = atof(argv[++i]) * 1024;
+    else if(!strcmp(argv[i], "-f") && i + 1 < argc)
+      mock.flashRate = atof(argv[++i]) * 1024;
+    else if(!strcmp(argv[i], "-d") && i + 1 < argc)
+      mock.dropPct = atoi(argv[++i]);
+    else if(argv[i][0] != '-' && nArgs < 2)
+      pArgs[nArgs++] = argv[i];
+    else
+      usage();
+  }
+  if(bMock && nArgs == 1)
+  {
+    pArgs[1] = pArgs[0];
+    pArgs[0] = "sim";
+  }
+  else if(nArgs != 2 || pKey == NULL)
+    usage();
+  if(chunk == 0 || mock.linkRate <= 0 || mock.flashRate <= 0)
+    usage();
+
+  std::string host = pArgs[0];
+  std::string port = "80";
+  size_t colon = host.find(':');
+  if(colon != std::string::npos)
+  {
+    port = host.substr(colon + 1);
+    host.resize(colon);
+  }
+
+  FILE *fp = fopen(pArgs[1], "rb");
+  if(fp == NULL)
+  {
+    perror(pArgs[1]);
+    return 1;
+  }
+  std::vector<uint8_t> raw;
+  uint8_t buf[4096];
+  size_t n;
+  while((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+    raw.insert(raw.end(), buf, buf + n);
+  fclose(fp);
+  if(raw.empty())
+  {
+    fprintf(stderr, "%s: empty\n", pArgs[1]);
+    return 1;
+  }
+  if(bMock)
+    return simulate(raw, chunk);
+
+  std::vector<uint8_t> image;
+  if(bGzip)
+  {
+    if(!gzip(raw, image))
+    {
+      fprintf(stderr, "gzip failed\n");
+      return 1;
+    }
+  }
+  else
+    image = raw;
+
+  std::string md5 = md5Hex(image);
+  std::string query = "/update?key=" + urlEncode(pKey) + "&size=" + std::to_string(image.size()) + "&md5=" + md5;
+
+  printf("image %zu bytes, sending %zu bytes%s, md5 %s\n", raw.size(), image.size(), bGzip ? " gzipped" : "", md5.c_str());
+
+  uploadStats st;
+  if(!upload(host, port, query, image, chunk, true, st))
+    return 1;
+
+  double rate = st.wire / st.secs;
+  printf("\ndone in %.1f s, %zu bytes on the wire (%.0f%% resent), %.1f KB/s, %d retries\n",
+    st.secs, st.wire, 100.0 * (st.wire - image.size()) / image.size(), rate / 1024, st.retries);
+  printf("uncompressed at this rate: %.1f s\n", raw.size() / rate);
+  return 0;
+}
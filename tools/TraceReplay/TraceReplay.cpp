@@ -0,0 +1,318 @@
+/*
+  TraceReplay.cpp - Replay a /trace.bin capture through the door/car detection logic.
+  Copyright 2016 Greg Cunningham, CuriousTech.net
+
+  Build: g++ -O2 -I../../Arduino -o TraceReplay TraceReplay.cpp
+  Usage: TraceReplay [-d doorThresh] [-c carThresh] [-w window] [-n medians] [-g glitchSec] [-v] trace.bin
+
+  Mirrors loop(): sonar samples feed RunningMedian, and once per second the average of the
+  middle medians is compared to the thresholds.  Reports detection latency (from the raw
+  samples crossing the threshold to the decision) and false transitions (a decision that
+  reverts within glitchSec).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "RunningMedian.h"
+
+enum traceChannel // must match SensorTrace.h
+{
+  TR_SONAR0, // car
+  TR_SONAR1, // door
+  TR_MOTION,
+  TR_TEMP,
+  TR_RH,
+  TR_CHANNELS
+};
+
+struct sample
+{
+  uint32_t ms;
+  uint8_t  ch;
+  int16_t  val;
+};
+
+struct options
+{
+  uint16_t doorThresh = 150;
+  uint16_t carThresh = 150;
+  int      window = 12;
+  uint8_t  nMedians = 2;
+  uint32_t glitchMs = 10000;
+  bool     bVerbose = false;
+};
+
+struct detector // one of door/car
+{
+  const char *name;
+  uint16_t thresh;
+  bool     bState = false;   // decided
+  bool     bSeeded = false;  // first decision made (seeds bState, not a transition)
+  bool     bRaw = false;     // last raw sample below threshold
+  uint32_t rawEdge = 0;      // ms of last raw crossing
+  uint32_t lastChange = 0;   // ms of last decided change
+  bool     bHaveChange = false;
+  int      transitions = 0;
+  int      falseTransitions = 0;
+  uint64_t latencySum = 0;
+  uint32_t latencyMax = 0;
+  int      latencyCnt = 0;
+};
+
+static uint32_t getVarint(const uint8_t *p, size_t len, size_t &pos)
+{
+  uint32_t v = 0;
+  uint8_t shift = 0;
+
+  while(pos < len)
+  {
+    uint8_t b = p[pos++];
+    v |= (uint32_t)(b & 0x7F) << shift;
+    shift += 7;
+    if((b & 0x80) == 0)
+      break;
+  }
+  return v;
+}
+
+static bool loadTrace(const char *pFile, std::vector<sample> &samples, int16_t base[TR_CHANNELS])
+{
+  FILE *fp = fopen(pFile, "rb");
+  if(fp == NULL)
+  {
+    perror(pFile);
+    return false;
+  }
+  std::vector<uint8_t> data;
+  uint8_t buf[4096];
+  size_t n;
+  while((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+    data.insert(data.end(), buf, buf + n);
+  fclose(fp);
+
+  const size_t hdr = 4 + 4 + 2 * TR_CHANNELS + 2;
+  if(data.size() < hdr || memcmp(&data[0], "GDT1", 4))
+  {
+    fprintf(stderr, "%s: not a GDT1 trace\n", pFile);
+    return false;
+  }
+
+  const uint8_t *p = &data[0];
+  uint32_t t = p[4] | p[5] << 8 | p[6] << 16 | (uint32_t)p[7] << 24; // ms, wraps with millis()
+  for(int ch = 0; ch < TR_CHANNELS; ch++)
+    base[ch] = p[8 + ch * 2] | p[9 + ch * 2] << 8;
+  size_t len = hdr + (p[hdr - 2] | p[hdr - 1] << 8);
+  if(len > data.size())
+  {
+    fprintf(stderr, "%s: truncated\n", pFile);
+    len = data.size();
+  }
+
+  int16_t last[TR_CHANNELS];
+  memcpy(last, base, sizeof(last));
+
+  for(size_t pos = hdr; pos < len; )
+  {
+    uint8_t tag = p[pos++];
+    uint32_t dt = tag & 31;
+    if(dt == 31)
+      dt = getVarint(p, len, pos);
+    uint16_t zz = getVarint(p, len, pos);
+    uint8_t ch = tag >> 5;
+    if(ch >= TR_CHANNELS)
+    {
+      fprintf(stderr, "%s: bad channel at %zu\n", pFile, pos);
+      return false;
+    }
+    t += dt * 10;
+    last[ch] += (int16_t)((zz >> 1) ^ -(zz & 1));
+    samples.push_back( {t, ch, last[ch]} );
+  }
+  return true;
+}
+
+static void decide(detector &d, bool bNew, uint32_t ms, const options &opt)
+{
+  if(!d.bSeeded) // the trace starts in this state
+  {
+    d.bSeeded = true;
+    d.bState = bNew;
+    if(opt.bVerbose)
+      printf("%10.1f %s starts %s\n", ms / 1000.0, d.name, bNew ? "on" : "off");
+    return;
+  }
+  if(bNew == d.bState)
+    return;
+
+  d.bState = bNew;
+  d.transitions++;
+  if(d.bHaveChange && ms - d.lastChange < opt.glitchMs)
+    d.falseTransitions++;
+  d.bHaveChange = true;
+  d.lastChange = ms;
+
+  uint32_t latency = 0;
+  if(d.bRaw == bNew)
+  {
+    latency = ms - d.rawEdge;
+    d.latencySum += latency;
+    d.latencyCnt++;
+    if(latency > d.latencyMax)
+      d.latencyMax = latency;
+  }
+  if(opt.bVerbose)
+    printf("%10.1f %s %s (latency %u ms)\n", ms / 1000.0, d.name, bNew ? "on" : "off", latency);
+}
+
+static void raw(detector &d, uint16_t val, uint32_t ms)
+{
+  bool b = (val < d.thresh);
+  if(b != d.bRaw)
+  {
+    d.bRaw = b;
+    d.rawEdge = ms;
+  }
+}
+
+template <int N> static void replay(const std::vector<sample> &samples, uint32_t startMs, const options &opt, detector &door, detector &car)
+{
+  RunningMedian<uint16_t, N> rangeMedian[2];
+  uint32_t nextSec = (startMs / 1000 + 1) * 1000;
+
+  for(const sample &s : samples)
+  {
+    while((int32_t)(s.ms - nextSec) >= 0) // once per second, as in loop()
+    {
+      float av;
+      if(rangeMedian[1].getAverage(opt.nMedians, av) == RunningMedian<uint16_t, N>::OK)
+      {
+        uint16_t doorVal = av;
+        decide(door, doorVal < door.thresh, nextSec, opt);
+      }
+      if(rangeMedian[0].getAverage(opt.nMedians, av) == RunningMedian<uint16_t, N>::OK)
+      {
+        uint16_t carVal = av;
+        decide(car, carVal < car.thresh, nextSec, opt);
+      }
+      nextSec += 1000;
+    }
+
+    switch(s.ch)
+    {
+      case TR_SONAR0:
+        rangeMedian[0].add(s.val);
+        raw(car, s.val, s.ms);
+        break;
+      case TR_SONAR1:
+        rangeMedian[1].add(s.val);
+        raw(door, s.val, s.ms);
+        break;
+    }
+  }
+}
+
+static void report(const detector &d)
+{
+  printf("%-5s transitions %4d  false %4d  latency avg %6.0f ms  max %6u ms\n", d.name,
+    d.transitions, d.falseTransitions, d.latencyCnt ? (double)d.latencySum / d.latencyCnt : 0.0, d.latencyMax);
+}
+
+static void usage()
+{
+  fprintf(stderr, "Usage: TraceReplay [-d doorThresh] [-c carThresh] [-w window] [-n medians] [-g glitchSec] [-v] trace.bin\n"
+                  "  window is one of 4 8 12 16 20 24 32 (firmware uses 12)\n");
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  options opt;
+  const char *pFile = NULL;
+
+  for(int i = 1; i < argc; i++)
+  {
+    if(argv[i][0] != '-')
+    {
+      pFile = argv[i];
+      continue;
+    }
+    if(argv[i][1] == 'v')
+    {
+      opt.bVerbose = true;
+      continue;
+    }
+    if(i + 1 >= argc)
+      usage();
+    int val = atoi(argv[++i]);
+    switch(argv[i - 1][1])
+    {
+      case 'd': opt.doorThresh = val; break;
+      case 'c': opt.carThresh = val; break;
+      case 'w': opt.window = val; break;
+      case 'n': opt.nMedians = val; break;
+      case 'g': opt.glitchMs = val * 1000; break;
+      default: usage();
+    }
+  }
+  if(pFile == NULL)
+    usage();
+
+  std::vector<sample> samples;
+  int16_t base[TR_CHANNELS];
+  if(!loadTrace(pFile, samples, base))
+    return 1;
+  if(samples.empty())
+  {
+    printf("Empty trace\n");
+    return 0;
+  }
+
+  detector door, car;
+  door.name = "door";
+  door.thresh = opt.doorThresh;
+  car.name = "car";
+  car.thresh = opt.carThresh;
+
+  uint32_t startMs = samples.front().ms;
+  clock_t c = clock();
+
+  switch(opt.window)
+  {
+    case 4:  replay<4>(samples, startMs, opt, door, car); break;
+    case 8:  replay<8>(samples, startMs, opt, door, car); break;
+    case 12: replay<12>(samples, startMs, opt, door, car); break;
+    case 16: replay<16>(samples, startMs, opt, door, car); break;
+    case 20: replay<20>(samples, startMs, opt, door, car); break;
+    case 24: replay<24>(samples, startMs, opt, door, car); break;
+    case 32: replay<32>(samples, startMs, opt, door, car); break;
+    default: usage();
+  }
+
+  double wall = (double)(clock() - c) / CLOCKS_PER_SEC;
+  double span = (samples.back().ms - startMs) / 1000.0;
+  int motion = 0;
+  int16_t tMin = 0x7FFF, tMax = -0x7FFF;
+  for(const sample &s : samples)
+  {
+    if(s.ch == TR_MOTION && s.val)
+      motion++;
+    if(s.ch == TR_TEMP)
+    {
+      if(s.val < tMin) tMin = s.val;
+      if(s.val > tMax) tMax = s.val;
+    }
+  }
+
+  printf("%zu samples, %.1f s traced, window %d, medians %u, door < %u, car < %u\n",
+    samples.size(), span, opt.window, opt.nMedians, opt.doorThresh, opt.carThresh);
+  report(door);
+  report(car);
+  printf("motion %d", motion);
+  if(tMin <= tMax)
+    printf("  temp %.1f to %.1f F", tMin / 10.0, tMax / 10.0);
+  printf("\nreplay %.3f s (%.0fx real time)\n", wall, wall > 0 ? span / wall : 0.0);
+  return 0;
+}